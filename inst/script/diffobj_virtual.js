@@ -0,0 +1,99 @@
+// diffobj - Compare R Objects with a Diff
+// Copyright (C) 2018  Brodie Gaslam
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// Go to <https://www.r-project.org/Licenses/GPL-3> for a copy of the license.
+
+/*
+ * Virtualized output
+ *
+ * For very large diffs all hunk groups but the first are stored as HTML
+ * strings in `diffobj_data` instead of as part of the page.  Each has a
+ * placeholder DIV sized to the rows it will contain, and only the hunk groups
+ * whose placeholders are within a screen of the visible part of the page are
+ * rendered.  Hunk groups that scroll away are collapsed back to placeholders
+ * with the height they had so the page does not jump.
+ *
+ * NOTE: this code is appended to `diffobj.js` and relies on the variables and
+ * functions it defines.
+ */
+
+var vgrps = content.getElementsByClassName("diffobj_vgrp");
+
+function vgrp_visible(k, top, bottom) {
+  var rec = vgrps[k].getBoundingClientRect();
+  return rec.bottom >= top && rec.top <= bottom;
+}
+function render_vgrps() {
+  var h = window.innerHeight || document.documentElement.clientHeight;
+  var top = -h, bottom = 2 * h;
+
+  // Placeholders are in page order, so binary search for the first one that
+  // is not above the rendering window
+
+  var lo = 0, hi = vgrps.length, mid;
+  while(lo < hi) {
+    mid = Math.floor((lo + hi) / 2);
+    if(vgrps[mid].getBoundingClientRect().bottom < top) lo = mid + 1;
+    else hi = mid;
+  }
+  var changed = false;
+  var shown = content.querySelectorAll(".diffobj_vgrp[data-shown]");
+  for(i = 0; i < shown.length; i++) {
+    var rec = shown[i].getBoundingClientRect();
+    if(rec.bottom < top || rec.top > bottom) {
+      shown[i].style.height = shown[i].offsetHeight + "px";
+      shown[i].innerHTML = "";
+      shown[i].removeAttribute("data-shown");
+      changed = true;
+    }
+  }
+  for(var k = lo; k < vgrps.length && vgrp_visible(k, top, bottom); k++) {
+    if(!vgrps[k].hasAttribute("data-shown")) {
+      vgrps[k].innerHTML =
+        diffobj_data[parseInt(vgrps[k].getAttribute("data-grp"))];
+      vgrps[k].style.height = "auto";
+      vgrps[k].setAttribute("data-shown", "");
+      changed = true;
+    }
+  }
+  if(changed && scale) resize_diff_out(scale);
+}
+if(typeof diffobj_data !== "undefined" && diffobj_data != null) {
+  // Resize timeouts account for rows that are not in the page
+
+  for(i = 0; i < vgrps.length; i++)
+    out_rows += parseInt(vgrps[i].getAttribute("data-rows"));
+  timeout_time =
+    out_rows < 100 ? 25 : Math.min(25 + (out_rows - 100) / 4, 500);
+
+  // Size placeholders from the height of the sample row
+
+  meta.style.display = "block";
+  var row_h = row[0].getBoundingClientRect().height;
+  meta.style.display = "none";
+  for(i = 0; i < vgrps.length; i++) {
+    vgrps[i].style.height =
+      parseInt(vgrps[i].getAttribute("data-rows")) * row_h + "px";
+  }
+  var vgrp_timeout;
+  window.addEventListener(
+    "scroll",
+    function() {
+      clearTimeout(vgrp_timeout);
+      vgrp_timeout = setTimeout(render_vgrps, 25);
+    },
+    true
+  );
+  window.addEventListener("resize", render_vgrps, true);
+  render_vgrps();
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2018  Brodie Gaslam
+ *
+ * This file is part of "diffobj - Diffs for R Objects"
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include "diffobj.h"
+
+/*
+ * Line alignment within hunks
+ *
+ * Lines are compared on their `eq` strings, optionally with everything but
+ * alphanumeric characters removed (`count.alnum.only`).  Only ASCII strings
+ * are handled so that the number of characters is the number of bytes and
+ * `[:alnum:]` has its plain C meaning.
+ */
+
+static int al_alnum(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+    (c >= '0' && c <= '9');
+}
+// Number of characters in the key
+
+static int al_len(const char *s, int len, int alnum) {
+  if(!alnum) return len;
+  int n = 0;
+  for(int i = 0; i < len; ++i) n += al_alnum(s[i]);
+  return n;
+}
+static uint64_t al_hash(const char *s, int len, int alnum) {
+  uint64_t h = 14695981039346656037ULL;  // FNV-1a
+  for(int i = 0; i < len; ++i)
+    if(!alnum || al_alnum(s[i]))
+      h = (h ^ (unsigned char) s[i]) * 1099511628211ULL;
+  return h;
+}
+static int al_eq(
+  const char *s1, int len1, const char *s2, int len2, int alnum
+) {
+  if(!alnum) return len1 == len2 && !memcmp(s1, s2, len1);
+  int i = 0, j = 0;
+  while(1) {
+    while(i < len1 && !al_alnum(s1[i])) ++i;
+    while(j < len2 && !al_alnum(s2[j])) ++j;
+    if(i == len1 || j == len2) break;
+    if(s1[i++] != s2[j++]) return 0;
+  }
+  return i == len1 && j == len2;
+}
+/*
+ * Match lines in `a` to lines in `b`
+ *
+ * Only lines with at least `min_chars` characters in their key, and with a
+ * token ratio (`a_tok`, `b_tok`) of at least `threshold` may match.  Each line
+ * in `a` in turn is matched to the first line in `b` with the same key that is
+ * after the last matched line in `b`.
+ *
+ * Returns the 1-based indices of the lines in `b` each line in `a` matched, or
+ * zero if none, or NULL if any of the strings are NA or not ASCII.
+ */
+SEXP DIFFOBJ_align(
+  SEXP a, SEXP b, SEXP a_tok, SEXP b_tok, SEXP min_chars, SEXP threshold,
+  SEXP alnum
+) {
+  if(
+    TYPEOF(a) != STRSXP || TYPEOF(b) != STRSXP ||
+    TYPEOF(a_tok) != REALSXP || TYPEOF(b_tok) != REALSXP ||
+    XLENGTH(a) != XLENGTH(a_tok) || XLENGTH(b) != XLENGTH(b_tok) ||
+    XLENGTH(a) > INT_MAX || XLENGTH(b) > INT_MAX
+  )
+    error("Logic Error: bad alignment data; contact maintainer."); // nocov
+
+  int na = (int) XLENGTH(a), nb = (int) XLENGTH(b);
+  int min_c = asInteger(min_chars), al = asLogical(alnum) == 1;
+  double thresh = asReal(threshold);
+
+  for(int k = 0; k < 2; ++k) {
+    SEXP x = k ? b : a;
+    for(int i = 0; i < (k ? nb : na); ++i) {
+      SEXP chrs = STRING_ELT(x, i);
+      if(chrs == NA_STRING) return R_NilValue;
+      const unsigned char *s = (const unsigned char *) CHAR(chrs);
+      for(int j = 0; j < LENGTH(chrs); ++j) if(s[j] > 127) return R_NilValue;
+    }
+  }
+  SEXP res = PROTECT(allocVector(INTSXP, na));
+  int *resi = INTEGER(res);
+  memset(resi, 0, na * sizeof(int));
+
+  // Open addressing hash table of the keys of the valid lines in `b`; each key
+  // records the next line with that key that could still be matched, and
+  // `next` links the lines with the same key in order
+
+  size_t tsize = 16;
+  while(tsize < 2 * (size_t) nb) tsize *= 2;
+  int *tab = (int *) R_alloc(tsize, sizeof(int));
+  memset(tab, 0, tsize * sizeof(int));
+  uint64_t *khash = (uint64_t *) R_alloc((size_t) nb + 1, sizeof(uint64_t));
+  int *khead = (int *) R_alloc((size_t) nb + 1, sizeof(int));
+  int *ktail = (int *) R_alloc((size_t) nb + 1, sizeof(int));
+  int *next = (int *) R_alloc((size_t) nb + 1, sizeof(int));
+  int nkey = 0;
+
+  for(int j = 0; j < nb; ++j) {
+    SEXP chrs = STRING_ELT(b, j);
+    const char *s = CHAR(chrs);
+    int len = LENGTH(chrs);
+    next[j] = -1;
+    if(al_len(s, len, al) < min_c || !(REAL(b_tok)[j] >= thresh)) continue;
+
+    uint64_t h = al_hash(s, len, al);
+    size_t slot = (size_t) h & (tsize - 1);
+    int key;
+    while((key = tab[slot])) {
+      SEXP chrk = STRING_ELT(b, khead[key]);
+      if(
+        khash[key] == h && al_eq(s, len, CHAR(chrk), LENGTH(chrk), al)
+      )
+        break;
+      slot = (slot + 1) & (tsize - 1);
+    }
+    if(key) {
+      next[ktail[key]] = j;
+    } else {
+      key = tab[slot] = ++nkey;
+      khash[key] = h;
+      khead[key] = j;
+    }
+    ktail[key] = j;
+  }
+  // Greedy in order matching; since the last matched line only moves forward
+  // we can permanently drop lines from the heads of the key lists
+
+  int last = -1;
+  for(int i = 0; i < na && nkey; ++i) {
+    SEXP chrs = STRING_ELT(a, i);
+    const char *s = CHAR(chrs);
+    int len = LENGTH(chrs);
+    if(al_len(s, len, al) < min_c || !(REAL(a_tok)[i] >= thresh)) continue;
+
+    uint64_t h = al_hash(s, len, al);
+    size_t slot = (size_t) h & (tsize - 1);
+    int key;
+    while((key = tab[slot])) {
+      if(khead[key] >= 0) {
+        SEXP chrk = STRING_ELT(b, khead[key]);
+        if(
+          khash[key] == h && al_eq(s, len, CHAR(chrk), LENGTH(chrk), al)
+        )
+          break;
+      }
+      slot = (slot + 1) & (tsize - 1);
+    }
+    if(!key) continue;
+    while(khead[key] >= 0 && khead[key] <= last) khead[key] = next[khead[key]];
+    if(khead[key] >= 0) {
+      last = khead[key];
+      resi[i] = last + 1;
+      khead[key] = next[last];
+    }
+  }
+  UNPROTECT(1);
+  return res;
+}
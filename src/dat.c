@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2018  Brodie Gaslam
+ *
+ * This file is part of "diffobj - Diffs for R Objects"
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
+ */
+
+#include <string.h>
+#include "diffobj.h"
+
+/*
+ * Mutable line data for `line_diff`
+ *
+ * `line_diff` keeps the data for each line in a list of parallel vectors
+ * (`tar.dat` and `cur.dat`).  The word diffs update these hunk by hunk, which
+ * with `[<-` on the list can copy whole vectors for each hunk.  Instead the
+ * list is kept in an external pointer and the word diffs write into the
+ * vectors in place.
+ *
+ * The pointer protects a list with the columns, and a logical vector that
+ * records which columns we own.  Columns that come from, or are handed back
+ * to, R are not owned, and are copied the first time they are written to, so
+ * each column is copied at most once no matter how many hunks there are.
+ */
+
+static SEXP dat_get_store(SEXP x) {
+  if(
+    TYPEOF(x) != EXTPTRSXP || R_ExternalPtrTag(x) != install("diffobj_dat")
+  )
+    error("Logic Error: not a line store; contact maintainer."); // nocov
+  return R_ExternalPtrProtected(x);
+}
+static R_xlen_t dat_col(SEXP cols, SEXP col) {
+  if(TYPEOF(col) != STRSXP || XLENGTH(col) != 1)
+    error("Logic Error: bad column name; contact maintainer."); // nocov
+  SEXP names = getAttrib(cols, R_NamesSymbol);
+  const char *name = CHAR(STRING_ELT(col, 0));
+  for(R_xlen_t i = 0; i < XLENGTH(cols); ++i)
+    if(!strcmp(CHAR(STRING_ELT(names, i)), name)) return i;
+  error("Logic Error: unknown column `%s`; contact maintainer.", name); // nocov
+  return -1; // nocov
+}
+// Copy `n` elements of `from` starting at `from_i` into `to` at `to_i`
+
+static void dat_copy(
+  SEXP to, R_xlen_t to_i, SEXP from, R_xlen_t from_i, R_xlen_t n
+) {
+  if(TYPEOF(to) != TYPEOF(from))
+    error("Logic Error: column type mismatch; contact maintainer."); // nocov
+  switch(TYPEOF(to)) {
+    case LGLSXP:
+      memcpy(LOGICAL(to) + to_i, LOGICAL(from) + from_i, n * sizeof(int));
+      break;
+    case INTSXP:
+      memcpy(INTEGER(to) + to_i, INTEGER(from) + from_i, n * sizeof(int));
+      break;
+    case REALSXP:
+      memcpy(REAL(to) + to_i, REAL(from) + from_i, n * sizeof(double));
+      break;
+    case STRSXP:
+      for(R_xlen_t i = 0; i < n; ++i)
+        SET_STRING_ELT(to, to_i + i, STRING_ELT(from, from_i + i));
+      break;
+    case VECSXP:
+      for(R_xlen_t i = 0; i < n; ++i)
+        SET_VECTOR_ELT(to, to_i + i, VECTOR_ELT(from, from_i + i));
+      break;
+    default:
+      error("Logic Error: bad column type; contact maintainer."); // nocov
+  }
+}
+// Validate the 1 based indices `ind` against a column of length `n`
+
+static void dat_check_ind(SEXP ind, R_xlen_t n) {
+  if(TYPEOF(ind) != INTSXP)
+    error("Logic Error: indices must be integer; contact maintainer."); // nocov
+  for(R_xlen_t i = 0; i < XLENGTH(ind); ++i) {
+    int j = INTEGER(ind)[i];
+    if(j == NA_INTEGER || j < 1 || j > n)
+      error("Logic Error: index out of bounds; contact maintainer."); // nocov
+  }
+}
+static SEXP dat_subset(SEXP x, SEXP ind) {
+  dat_check_ind(ind, XLENGTH(x));
+  R_xlen_t n = XLENGTH(ind);
+  SEXP res = PROTECT(allocVector(TYPEOF(x), n));
+  for(R_xlen_t i = 0; i < n; ++i)
+    dat_copy(res, i, x, INTEGER(ind)[i] - 1, 1);
+  UNPROTECT(1);
+  return res;
+}
+/*
+ * Create a store from the list `x`; the list itself is copied, but not the
+ * columns.
+ */
+SEXP DIFFOBJ_dat_new(SEXP x) {
+  if(TYPEOF(x) != VECSXP)
+    error("Logic Error: `x` must be a list; contact maintainer."); // nocov
+  SEXP prot = PROTECT(allocVector(VECSXP, 2));
+  SET_VECTOR_ELT(prot, 0, shallow_duplicate(x));
+  SEXP owned = allocVector(LGLSXP, XLENGTH(x));
+  SET_VECTOR_ELT(prot, 1, owned);
+  memset(LOGICAL(owned), 0, XLENGTH(x) * sizeof(int));
+  SEXP res = R_MakeExternalPtr(NULL, install("diffobj_dat"), prot);
+  UNPROTECT(1);
+  return res;
+}
+/*
+ * Return column `col`, or if `ind` is not NULL, the elements `ind` of it.  A
+ * whole column is shared with R afterwards so we give up ownership.
+ */
+SEXP DIFFOBJ_dat_get(SEXP x, SEXP col, SEXP ind) {
+  SEXP store = dat_get_store(x);
+  SEXP cols = VECTOR_ELT(store, 0);
+  R_xlen_t i = dat_col(cols, col);
+  SEXP res = VECTOR_ELT(cols, i);
+  if(ind != R_NilValue) return dat_subset(res, ind);
+  LOGICAL(VECTOR_ELT(store, 1))[i] = 0;
+  MARK_NOT_MUTABLE(res);
+  return res;
+}
+/*
+ * Set elements `ind` of column `col` to `value` in place, or if `ind` is
+ * NULL, replace the column with `value`.
+ */
+SEXP DIFFOBJ_dat_set(SEXP x, SEXP col, SEXP ind, SEXP value) {
+  SEXP store = dat_get_store(x);
+  SEXP cols = VECTOR_ELT(store, 0);
+  int *owned = LOGICAL(VECTOR_ELT(store, 1));
+  R_xlen_t i = dat_col(cols, col);
+
+  if(ind == R_NilValue) {
+    SET_VECTOR_ELT(cols, i, value);
+    owned[i] = 0;
+    return R_NilValue;
+  }
+  SEXP target = VECTOR_ELT(cols, i);
+  dat_check_ind(ind, XLENGTH(target));
+  if(XLENGTH(ind) != XLENGTH(value))
+    error("Logic Error: value length mismatch; contact maintainer."); // nocov
+  if(!XLENGTH(ind)) return R_NilValue;
+  if(!owned[i]) {
+    target = shallow_duplicate(target);
+    SET_VECTOR_ELT(cols, i, target);
+    owned[i] = 1;
+  }
+  for(R_xlen_t j = 0; j < XLENGTH(ind); ++j)
+    dat_copy(target, INTEGER(ind)[j] - 1, value, j, 1);
+  return R_NilValue;
+}
+/*
+ * Return a list with the rows `ind` of every column
+ */
+SEXP DIFFOBJ_dat_rows(SEXP x, SEXP ind) {
+  SEXP cols = VECTOR_ELT(dat_get_store(x), 0);
+  R_xlen_t n = XLENGTH(cols);
+  SEXP res = PROTECT(allocVector(VECSXP, n));
+  for(R_xlen_t i = 0; i < n; ++i)
+    SET_VECTOR_ELT(res, i, dat_subset(VECTOR_ELT(cols, i), ind));
+  setAttrib(res, R_NamesSymbol, getAttrib(cols, R_NamesSymbol));
+  UNPROTECT(1);
+  return res;
+}
+/*
+ * Replace rows `lo` through `hi` (1 based) of every column with the elements
+ * of the matching column of the list `value`, which may have a different
+ * number of rows.
+ */
+SEXP DIFFOBJ_dat_splice(SEXP x, SEXP lo, SEXP hi, SEXP value) {
+  SEXP store = dat_get_store(x);
+  SEXP cols = VECTOR_ELT(store, 0);
+  int *owned = LOGICAL(VECTOR_ELT(store, 1));
+  if(
+    TYPEOF(lo) != INTSXP || XLENGTH(lo) != 1 ||
+    TYPEOF(hi) != INTSXP || XLENGTH(hi) != 1 ||
+    TYPEOF(value) != VECSXP || XLENGTH(value) != XLENGTH(cols)
+  )
+    error("Logic Error: bad splice arguments; contact maintainer."); // nocov
+
+  R_xlen_t l = asInteger(lo) - 1, h = asInteger(hi);
+  for(R_xlen_t i = 0; i < XLENGTH(cols); ++i) {
+    SEXP orig = VECTOR_ELT(cols, i);
+    SEXP sub = VECTOR_ELT(value, i);
+    R_xlen_t n = XLENGTH(orig), n_new = XLENGTH(sub);
+    if(l < 0 || h < l || h > n)
+      error("Logic Error: splice out of bounds; contact maintainer."); // nocov
+
+    SEXP res = PROTECT(allocVector(TYPEOF(orig), n - (h - l) + n_new));
+    dat_copy(res, 0, orig, 0, l);
+    dat_copy(res, l, sub, 0, n_new);
+    dat_copy(res, l + n_new, orig, h, n - h);
+    SET_VECTOR_ELT(cols, i, res);
+    owned[i] = 1;
+    UNPROTECT(1);
+  }
+  return R_NilValue;
+}
+/*
+ * Return the columns as a named list, after which none of them are owned
+ */
+SEXP DIFFOBJ_dat_list(SEXP x) {
+  SEXP store = dat_get_store(x);
+  SEXP cols = VECTOR_ELT(store, 0);
+  int *owned = LOGICAL(VECTOR_ELT(store, 1));
+  for(R_xlen_t i = 0; i < XLENGTH(cols); ++i) {
+    owned[i] = 0;
+    MARK_NOT_MUTABLE(VECTOR_ELT(cols, i));
+  }
+  return shallow_duplicate(cols);
+}
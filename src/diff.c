@@ -68,9 +68,14 @@
  * - Switch memory allocation and error handling to R specific functions
  * - Removing variable arrays in favor of fixed sized buffers to simplify code;
  *   this results in potential overallocation of memory since we pre-allocate a
- *   4 * (n + m + abs(n - m)) + 1 vector which is wasteful but still linear so
- *   should be okay.
+ *   4 * (n + m + abs(n - m) + 3) + 2 vector which is wasteful but still linear
+ *   so should be okay.
  * - Removing ability to specify custom comparison functions
+ * - Optionally running the two halves of the divide and conquer recursion in
+ *   parallel with OpenMP tasks
+ * - Making the algorithm generic over the vector element type (see
+ *   "diff_tpl.h") so that integer, double, and raw vectors can be diffed
+ *   directly instead of after coercion to character
  * - Adding a failover result if diffs exceed maximum allowable diffs whereby
  *   we failover into a linear time algorithm to produce a sub optimal edit
  *   script rather than simply saying the shortest edit script is longer than
@@ -81,10 +86,31 @@
 
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if defined(__GNUC__) && (defined(__AVX2__) || defined(__SSE2__))
+#include <immintrin.h>
+#endif
 #include "diffobj.h"
 
-#define FV(k) _v(ctx, (k), 0)
-#define RV(k) _v(ctx, (k), 1)
+/* Furthest reaching x coordinate on diagonal `k` for forward (FV) and reverse
+ * (RV) paths; the diagonal range is checked only in debug builds (i.e. if
+ * NDEBUG is not defined), see _buf_init for why we stay within it.
+ */
+#ifdef NDEBUG
+#define FV(k) (ctx->fv[(k)])
+#define RV(k) (ctx->rv[(k)])
+#else
+#define FV(k) (*_v(ctx, ctx->fv, (k)))
+#define RV(k) (*_v(ctx, ctx->rv, (k)))
+#endif
 
 // We can't reach some branches through tests so they are untested, they may not
 // be reachable so we mark them as no-cov; we really should figure the logic out
@@ -98,13 +124,38 @@ static const char * err_msg_ubrnch =
  */
 struct _ctx {
   void *context;
+  SEXP a;                 // original vectors, see _discard
+  SEXP b;
   int *buf;               // used to be varray
-  int bufmax;
+  int bufcap;             // allocated size of buf
+  int *fv;                // forward and reverse V arrays in buf, centered on
+  int *rv;                //   diagonal zero, see _buf_init
+  int vmax;               // largest |k| addressable in fv and rv
+  int vhw;                // largest |k| possibly written since cleared
+  struct diff_ws *ws;     // NULL, or workspace that owns buf and faux
+  diff_op *faux;          // stack of faux snakes, see _find_faux_snake
+  int fauxtop;
+  int fauxcap;
   struct diff_edit *ses;  // used to be varray
   int si;
   int simax;
   int dmax;
   int dmaxhit;
+  double tol_abs;         // only used for doubles
+  double tol_rel;
+  int threads;
+  // When running in parallel (`par`) we may not use the R API as it is not
+  // thread safe, so errors are recorded in `errmsg` and we `longjmp` back to
+  // the start of the task, and memory comes from `malloc` and is tracked in
+  // `allocs` so the parent task can free it, see _err and _alloc.
+  int par;
+  jmp_buf *jmp;
+  struct _alloc *allocs;
+  char errmsg[256];
+  int *intr;              // NULL, or flag shared by the tasks, see _interrupt
+};
+struct _alloc {
+  struct _alloc *next;
 };
 
 struct middle_snake {
@@ -124,340 +175,187 @@ const char * _op_to_chr(diff_op op) {
 }
 */
 /*
- * k = diagonal number
- * val = x value
- * r = presumably whether we are looking up in reverse snakes
+ * Signal an error; in parallel mode the error is only recorded and must be
+ * thrown by the main thread once all tasks complete, see _ses_top.
  */
   static void
-_setv(struct _ctx *ctx, int k, int r, int val)
+_err(struct _ctx *ctx, const char *fmt, ...)
 {
-  int j;
-  int *i;
-  /* Pack -N to N into 0 to N * 2, but also pack reverse and forward snakes
-   * in that same space which is why we need the * 4
-   */
-  j = k <= 0 ? -k * 4 + r : k * 4 + (r - 2);
-
-  if(j > ctx->bufmax || j < 0) {
-    // nocov start
-    error(
-      "Logic Error: exceeded buffer size (%d vs %d); contact maintainer.",
-      j, ctx->bufmax
-    );
-    // nocov end
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(ctx->errmsg, sizeof(ctx->errmsg), fmt, args);
+  va_end(args);
+  if(ctx->par) longjmp(*ctx->jmp, 1);
+  error("%s", ctx->errmsg);
+}
+/*
+ * Check for user interrupts.  In parallel mode only the main thread, which is
+ * the master of the OpenMP team, may check, and it must not jump out of the
+ * parallel region, so it records the interrupt in `intr` where the other
+ * tasks see it, and each task then stops with an error.
+ */
+  static void
+_interrupt_chk(void *data)
+{
+  (void) data;
+  R_CheckUserInterrupt();
+}
+  static void
+_interrupt(struct _ctx *ctx)
+{
+  if(!ctx->par) {
+    R_CheckUserInterrupt();
+    return;
   }
-  i = ctx->buf + j;
-  *i = val;
+#ifdef _OPENMP
+  if(!ctx->intr) return;
+  int intr;
+  if(!omp_get_thread_num() && !R_ToplevelExec(_interrupt_chk, NULL)) {
+    #pragma omp atomic write
+    *ctx->intr = 1;
+  }
+  #pragma omp atomic read
+  intr = *ctx->intr;
+  if(intr) _err(ctx, "Diff interrupted by user.");
+#endif
 }
 /*
- * For any given `k` diagonal, return the x coordinate of the furthest reaching
- * path we've found.  Use `r` to look for the x coordinate for the paths that
- * are starting from the bottom right instead of top left
+ * Allocate zeroed memory that lasts for the duration of the diff; in parallel
+ * mode the memory must be released with _free_allocs.
  */
-  static int
-_v(struct _ctx *ctx, int k, int r)
+  static void *
+_alloc(struct _ctx *ctx, size_t n, size_t size)
 {
-  int j;
-
-  j = k <= 0 ? -k * 4 + r : k * 4 + (r - 2);
-  if(j > ctx->bufmax || j < 0) {
-    // nocov start
-    error(
-      "Logic Error: exceeded buffer 2 size (%d vs %d); contact maintainer.",
-      j, ctx->bufmax
-    );
-    // nocov end
+  if(!ctx->par) {
+    void *res = R_alloc(n, size);
+    memset(res, 0, n * size);
+    return res;
   }
-  int bufval = *(ctx->buf + j);
-  return bufval;
+  struct _alloc *res = calloc(1, sizeof(struct _alloc) + n * size);
+  if(!res) _err(ctx, "Unable to allocate memory for diff.");
+  res->next = ctx->allocs;
+  ctx->allocs = res;
+  return (void *)(res + 1);
 }
-/* Compare character vector values
- *
- * Needs to account for special case when indeces are oob for the strings.  The
- * oob checks seem to be necessary since algo is requesting reads past length
- * of string, but not sure if that is intentional or not.  In theory it should
- * not be, but perhaps this was handled gracefully by the varray business b4
- * we changed it.
+  static void
+_free_allocs(struct _alloc *allocs)
+{
+  while(allocs) {
+    struct _alloc *next = allocs->next;
+    free(allocs);
+    allocs = next;
+  }
+}
+#ifndef NDEBUG
+/*
+ * Bounds checked access to the V arrays, only used in debug builds via FV and
+ * RV
  */
-int _comp_chr(SEXP a, int aidx, SEXP b, int bidx) {
-  int alen = XLENGTH(a);
-  int blen = XLENGTH(b);
-  int comp;
-  if(aidx >= alen && bidx >= blen) {
+  static int *
+_v(struct _ctx *ctx, int *v, int k)
+{
+  if(k > ctx->vmax || k < -ctx->vmax) {
     // nocov start
-    error(err_msg_ubrnch, 1);
-    comp = 1;
+    _err(
+      ctx, "Logic Error: exceeded buffer size (%d vs %d); contact maintainer.",
+      k, ctx->vmax
+    );
     // nocov end
-  } else if(aidx >= alen || bidx >= blen) {
-    comp = 0;
-  } else comp = STRING_ELT(a, aidx) == STRING_ELT(b, bidx);
-  return(comp);
+  }
+  return v + k;
 }
+#endif
 /*
- * Handle cases where differences exceed maximum allowable differences
+ * Make sure the buffer is large enough for a problem of size n and m, and zero
+ * the part of it we will use.  We only allocate once we know how much of the
+ * problem is left after trimming and discarding (see _discard).
  *
- * General logic is to create a faux snake that instead of moving down
- * diagonally will chain right and down moves until it hits a path coming
- * from the other direction.  This snake is stored in `ctx`, and is then
- * written by `ses` to the `ses` list.
+ * The buffer holds the forward and reverse V arrays one after the other, each
+ * indexed directly by diagonal number from -vmax to vmax.  The reverse
+ * diagonals are offset by the difference in lengths, and the search stops
+ * once it has covered half the edit graph, so no recursive sub-problem can
+ * reach past diagonal n + m + |n - m| + 2 (plus one more for the faux snake
+ * search).  Since we track the furthest diagonal possibly written we only need
+ * to clear up to that, which is typically much less than the whole buffer.  A
+ * negative `vmax` means we don't know what was written so we clear it all.
+ * If we have a workspace we use its memory, and also reserve the faux snake
+ * stack there.
  */
-static int
-_find_faux_snake(
-  SEXP a, int aoff, int n, SEXP b, int boff, int m, struct _ctx *ctx,
-  struct middle_snake *ms, int d, diff_op ** faux_snake
-) {
-  /* normally we would record k/x values at the end of the furthest reaching
-   * snake, but here we need pick a path from top left  and extend it until
-   * we hit something coming from bottom right.
-   */
-  /* start by finding which diagonal has the furthest reaching value
-   * when looking from top left
-   */
-  int k_max_f = 0, x_max_f = -1;
-  int x_f, y_f, k_f;
+  static void
+_buf_init(struct _ctx *ctx, int n, int m)
+{
   int delta = n - m;
+  if(delta < 0) delta = -delta;
+  int vmax = n + m + delta + 3;
+  if(vmax < n || vmax < m || vmax > (INT_MAX - 2) / 4)
+    _err(ctx, "Logic Error: exceeded maximum allowable combined string length.");  // nocov
+  int bufmax = 2 * (2 * vmax + 1);
 
-  for (int k = d - 1; k >= -d + 1; k -= 2) { /* might need to shift by 1 */
-    int x_f = FV(k);
-    int f_dist = x_f - abs(k);
-
-    if(x_f > n || x_f - k > m) continue;
-
-    if(f_dist > x_max_f - abs(k_max_f)) {
-      x_max_f = x_f;
-      k_max_f = k;
-    }
-  }
-  /* didn't find a path so use origin */
-  if(x_max_f < 0) {
-    // nocov start
-    error(err_msg_ubrnch, 2);
-    x_f = y_f = k_f = 0;
-    // nocov end
-  } else {
-    k_f = k_max_f;
-    x_f = x_max_f;
-    y_f = x_f - k_max_f;
-  }
-  /*
-   * now look for the furthest reaching point in any diagonal that is
-   * below the diagonal we found above since those are the only ones we
-   * can connect to
-   *
-   */
-  int k_max_r = 0, x_max_r = n + 1;
-  int x_r, y_r;
-
-  for (int k = -d; k <= k_max_f - delta; k += 2) {
-    int x_r = RV(k);
-    int r_dist = n - x_r - abs(k);
-    /* skip reverse snakes that overshoot our forward snake
-     * ---\
-     *     \
-     *   \
-     *    \
-     *     \---
-     * where there should be a decent path we can use, but because we are only
-     * tracking the last coordinates we don't really have a way connecting this
-     * type of path so we just go straight to the origin even though that is
-     * even more sub-optinal; not even sure if this is a possible scenario
-     */
-    if(x_r < x_f || x_r - k - delta < y_f) continue;
-
-    /* since buffer is init to zero, an x_r value of zero means nothing, and
-     * not all the way to the left of the graph; also, in reverse snakes the
-     * snake should end at x == 1 in the leftmost case (we think)
-     */
-    if(r_dist > n - x_max_r - abs(k_max_r) && x_r) {
-      x_max_r = x_r;
-      k_max_r = k;
+  struct diff_ws *ws = ctx->ws;
+  if(bufmax > ctx->bufcap) {
+    if(ws) {
+      free(ws->buf);
+      ws->buf = (int *) calloc(bufmax, sizeof(int));
+      ws->bufcap = 0;
+      if(!ws->buf) _err(ctx, "Unable to allocate memory for diff.");
+      ws->bufcap = bufmax;
+      ctx->buf = ws->buf;
+    } else {
+      ctx->buf = (int *) _alloc(ctx, bufmax, sizeof(int));
     }
+    ctx->bufcap = bufmax;
+  } else if(ctx->vmax < 0) {
+    memset(ctx->buf, 0, ctx->bufcap * sizeof(int));
+  } else if(ctx->vhw >= 0) {
+    size_t len = (2 * (size_t) ctx->vhw + 1) * sizeof(int);
+    memset(ctx->fv - ctx->vhw, 0, len);
+    memset(ctx->rv - ctx->vhw, 0, len);
   }
-  if(x_max_r >= n) {
-    x_r = n; y_r = m;
-  } else {
-    x_r = x_max_r;
-    /* not 100% sure about this one; seems like k_max_r is relative to the
-     * bottom right origin, so maybe this should be x_r - k_max_r - delta?
-     */
-    y_r = x_r - k_max_r - delta;
-  }
-  /*
-   * attempt to connect the two paths we found.  We need to store this
-   * information as our "faux" snake since it will have to be processed
-   * in a manner similar as the middle snake would be processed; start by
-   * figuring out max number of steps it would take to connect the two
-   * paths
-   */
-  int max_steps = x_r - x_f + y_r - y_f + 1;
-  int steps = 0;
-  int diffs = 0;
-  int step_dir = 1; /* last direction we moved in, 1 is down */
-  int x_sn = x_f, y_sn = y_f;
+  ctx->vmax = vmax;
+  ctx->vhw = -1;
+  ctx->fv = ctx->buf + vmax;
+  ctx->rv = ctx->buf + 3 * vmax + 1;
 
-  /* initialize the fake snake */
-  if(max_steps < 0)
-    error("Logic Error: fake snake step overflow? Contact maintainer."); // nocov
+  // Faux snakes are nested at most along a path through the edit graph, each
+  // with one extra element for the terminator
 
-  diff_op * faux_snake_tmp = (diff_op*) R_alloc(max_steps, sizeof(diff_op));
-  for(int i = 0; i < max_steps; i++) *(faux_snake_tmp + i) = DIFF_NULL;
-
-  /* we have a further reaching reverse snake:
-   * not entirely sure if this should happen, but it seems it does
-   */
-  while(x_sn < x_r || y_sn < y_r) {
-    if(x_sn > x_r || y_sn > y_r) {
-      error("Logic Error: Exceeded buffer for finding fake snake; contact maintainer.");  // nocov
+  ctx->fauxtop = 0;
+  if(ws) {
+    int fauxcap = 2 * (n + m + 1);
+    if(fauxcap > ws->fauxcap) {
+      free(ws->faux);
+      ws->fauxcap = 0;
+      ws->faux = (diff_op *) malloc(fauxcap * sizeof(diff_op));
+      if(!ws->faux) _err(ctx, "Unable to allocate memory for diff.");
+      ws->fauxcap = fauxcap;
     }
-    /* check to see if we could possibly move on a diagonal, and do so
-     * if possible, if not alternate going down and right*/
-    if(
-        x_sn <= x_r && y_sn <= y_r &&
-        _comp_chr(a, aoff + x_sn, b, boff + y_sn)
-    ) {
-      x_sn++; y_sn++;
-      *(faux_snake_tmp + steps) = DIFF_MATCH;
-    } else if (x_sn < x_r && (step_dir || y_sn >= y_r)) {
-      x_sn++;
-      diffs++;
-      step_dir = !step_dir;
-      *(faux_snake_tmp + steps) = DIFF_DELETE;
-    } else if (y_sn < y_r && (!step_dir || x_sn >= x_r)) {
-      y_sn++;
-      diffs++;
-      *(faux_snake_tmp + steps) = DIFF_INSERT;
-      step_dir = !step_dir;
-    } else {
-      error("Logic Error: unexpected outcome in snake creation process; contact maintainer"); // nocov
-    }
-    steps++;
+    ctx->faux = ws->faux;
+    ctx->fauxcap = ws->fauxcap;
   }
-  /* corner cases; must absolutely make sure steps LT max_steps since we rely
-   * on at least one zero at the end of the faux_snake when we read it to know
-   * to stop reading it
-   */
-  if(x_sn != x_r || y_sn != y_r || steps >= max_steps) {
-    error("Logic Error: faux snake process failed; contact maintainer."); // nocov
-  }
-  /* modify the pointer to the pointer so we can return in by ref */
-
-  *faux_snake = faux_snake_tmp;
-
-  /* record the coordinates of our faux snake using `ms` */
-  ms->x = x_f;
-  ms->y = y_f;
-  ms->u = x_r;
-  ms->v = y_r;
-
-  return diffs;
 }
-
 /*
- * Advance from both ends of the diff graph toward center until we reach
- * up to half of the maximum possible number of differences between
- * a and b (note that `n` is net of `aoff`).  As we process this we record the
- * end points of each path we explored in the `ctx` structure.  Once we reach
- * the maximum number of differences, we return to `_ses` with the number of
- * differences found.  `_ses` will then attempt to stitch back the snakes
- * together.
+ * Get an edit script from the workspace, with room for at least `n` edits;
+ * returns NULL if memory could not be allocated
  */
-  static int
-_find_middle_snake(
-  SEXP a, int aoff, int n, SEXP b, int boff, int m, struct _ctx *ctx,
-  struct middle_snake *ms, diff_op ** faux_snake
-) {
-  int delta, odd, mid, d;
-
-  delta = n - m;
-  odd = delta & 1;
-  mid = (n + m) / 2;
-  mid += odd;
-
-  _setv(ctx, 1, 0, 0);
-  _setv(ctx, delta - 1, 1, n);
-
-  /* For each number of differences `d`, compute the farthest reaching paths
-   * from both the top left and bottom right of the edit graph
-   */
-  for (d = 0; d <= mid; d++) {
-    int k, x, y;
-
-    /* reached maximum allowable differences before real exit condition*/
-    if ((2 * d - 1) >= ctx->dmax) {
-      ctx->dmaxhit = 1;
-      return _find_faux_snake(a, aoff, n, b, boff, m, ctx, ms, d, faux_snake);
-    }
-    /* Forward (from top left) paths*/
-
-    for (k = d; k >= -d; k -= 2) {
-      if (k == -d || (k != d && FV(k - 1) < FV(k + 1))) {
-        x = FV(k + 1);
-      } else {
-        x = FV(k - 1) + 1;
-      }
-      y = x - k;
-
-      ms->x = x;
-      ms->y = y;
-      while(x < n && y < m && _comp_chr(a, aoff + x, b, boff + y)) {
-        /* matching characters, just walk down diagonal */
-        x++; y++;
-      }
-      _setv(ctx, k, 0, x);
-
-      /* for this diagonal we (think we) are now at farthest reaching point for
-       * a given d.  Then return if:
-       * - If we're at the edge of the addressable part of the graph
-       * - The reverse snakes are already overlapping in the `x` coordinate
-       *
-       * then it means that the only way to get to the snake coming from the
-       * other direction is by either moving down or across for every remaining
-       * move, so record the current coord as `u` and `v` and return
-       *
-       * Note that for the backward snake we reverse xy and uv so that the
-       * matching snake is always defined in `ms` as starting at `ms.(xy)` and
-       * ending at `ms.(uv)`
-       */
-      if (odd && k >= (delta - (d - 1)) && k <= (delta + (d - 1))) {
-        if (x >= RV(k)) {
-          ms->u = x;
-          ms->v = y;
-          return 2 * d - 1;
-        }
-      }
-    }
-    /* Backwards (from bottom right) paths*/
-
-    for (k = d; k >= -d; k -= 2) {
-      int kr = (n - m) + k;
-
-      if (k == d || (k != -d && RV(kr - 1) < RV(kr + 1))) {
-        x = RV(kr - 1);
-      } else {
-        x = RV(kr + 1) - 1;
-      }
-      y = x - kr;
-
-      ms->u = x;
-      ms->v = y;
-
-      while (x > 0 && y > 0 && _comp_chr(a, aoff + x - 1, b, boff + y - 1)) {
-        /* matching characters, just walk up diagonal */
-        x--; y--;
-      }
-      _setv(ctx, kr, 1, x);
-
-      /* see comments in forward section */
-      if (!odd && kr >= -d && kr <= d) {
-        if (x <= FV(kr)) {
-          ms->x = x;
-          ms->y = y;
-          return 2 * d;
-        }
-      }
-    }
+  struct diff_edit *
+diff_ws_ses(struct diff_ws *ws, int n)
+{
+  if(n > ws->sescap) {
+    free(ws->ses);
+    ws->sescap = 0;
+    ws->ses = (struct diff_edit *) malloc(n * sizeof(struct diff_edit));
+    if(!ws->ses) return NULL;
+    ws->sescap = n;
   }
-  error("Logic Error: failed finding middle snake, contact maintainer"); // nocov
+  return ws->ses;
+}
+  void
+diff_ws_free(struct diff_ws *ws)
+{
+  free(ws->buf);
+  free(ws->ses);
+  free(ws->faux);
+  memset(ws, 0, sizeof(struct diff_ws));
 }
 /*
  * Update edit script atom with newest info, we record the operation, and the
@@ -475,12 +373,12 @@ _edit(struct _ctx *ctx, int op, int off, int len)
                    */
   e = ctx->ses + ctx->si;
   if(ctx->si > ctx->simax)
-    error("Logic Error: exceed edit script length; contact maintainer."); // nocov
+    _err(ctx, "Logic Error: exceed edit script length; contact maintainer."); // nocov
   if (e->op != op) {
     if (e->op) {
       ctx->si++;
       if(ctx->si > ctx->simax)
-        error("Logic Error: exceed edit script length; contact maintainer."); // nocov
+        _err(ctx, "Logic Error: exceed edit script length; contact maintainer."); // nocov
       e = ctx->ses + ctx->si;
     }
     e->op = op;
@@ -507,231 +405,773 @@ _edit_faux(struct _ctx *ctx, diff_op * faux_snake, int aoff, int boff) {
       case DIFF_INSERT: off = boff++;
         break;
       default:
-        error("Logic Error: unexpected faux snake instruction; contact maintainer"); // nocov
+        _err(ctx, "Logic Error: unexpected faux snake instruction; contact maintainer"); // nocov
     }
     /* use x (aoff) offset for MATCH and DELETE, y offset for INSERT */
     _edit(ctx, op, off, 1);
   }
 }
-/* Generate shortest edit script
+static int _discard(struct _ctx *ctx, int aoff, int n, int boff, int m);
+
+// Minimum combined length for suffix trimming and discarding, see "diff_tpl.h"
+
+#define DIFF_PREP_MIN 1000
+
+// Minimum combined length of sub-problems to diff in parallel
+
+#ifndef DIFF_PAR_MIN
+#define DIFF_PAR_MIN 20000
+#endif
+
+/*
+ * Snake extension kernels: count how many bytes match at the start of `a` and
+ * `b` (_run_fwd), or at the end of the `n` bytes preceding them (_run_rev).
  *
+ * Walking a snake one element at a time is the hot loop of the algorithm, and
+ * long runs of matching elements are the common case, so where the compiler
+ * targets SSE2 or AVX2 (e.g. SSE2 is part of x86-64) we compare 16 or 32
+ * bytes at a time.  Otherwise we fall back to the portable byte loop.  The
+ * caller converts the byte count to whole elements, see DIFF_FN(_snake_fwd).
+ */
+#if defined(__GNUC__) && defined(__AVX2__)
+#define DIFF_VEC_BYTES 32
+#define DIFF_VEC_MASK(a, b) ((unsigned int) _mm256_movemask_epi8(        \
+  _mm256_cmpeq_epi8(                                                      \
+    _mm256_loadu_si256((const __m256i *)(a)),                             \
+    _mm256_loadu_si256((const __m256i *)(b))                              \
+) ) )
+#elif defined(__GNUC__) && defined(__SSE2__)
+#define DIFF_VEC_BYTES 16
+#define DIFF_VEC_MASK(a, b) ((unsigned int) _mm_movemask_epi8(            \
+  _mm_cmpeq_epi8(                                                         \
+    _mm_loadu_si128((const __m128i *)(a)),                                \
+    _mm_loadu_si128((const __m128i *)(b))                                 \
+) ) | 0xFFFF0000U)
+#endif
+
+  static inline size_t
+_run_fwd(const unsigned char *a, const unsigned char *b, size_t n)
+{
+  size_t i = 0;
+#ifdef DIFF_VEC_BYTES
+  for(; i + DIFF_VEC_BYTES <= n; i += DIFF_VEC_BYTES) {
+    unsigned int neq = ~DIFF_VEC_MASK(a + i, b + i);
+    if(neq) return i + __builtin_ctz(neq);
+  }
+#endif
+  while(i < n && a[i] == b[i]) i++;
+  return i;
+}
+  static inline size_t
+_run_rev(const unsigned char *a, const unsigned char *b, size_t n)
+{
+  size_t i = 0;
+#ifdef DIFF_VEC_BYTES
+  for(; i + DIFF_VEC_BYTES <= n; i += DIFF_VEC_BYTES) {
+    // with SSE2 the top half of the mask is always set, so `neq` only ever
+    // has bits in the low 16
+    unsigned int neq = ~DIFF_VEC_MASK(
+      a - i - DIFF_VEC_BYTES, b - i - DIFF_VEC_BYTES
+    );
+    if(neq) return i + __builtin_clz(neq) - (32 - DIFF_VEC_BYTES);
+  }
+#endif
+  while(i < n && a[-1 - (ptrdiff_t) i] == b[-1 - (ptrdiff_t) i]) i++;
+  return i;
+}
+/*
+ * Element comparisons for each of the supported vector types.
+ *
+ * Strings are compared by CHARSXP address, which works because R caches all
+ * strings so that identical strings (in the same encoding) share the same
+ * CHARSXP.  Doubles are compared exactly unless a tolerance is provided, with
+ * NA only matching NA and NaN only matching NaN.  Note that once a tolerance
+ * is involved equality is no longer transitive, which is fine for the
+ * algorithm since it only ever compares pairs of elements.
+ */
+static inline int _eq_dbl(double x, double y) {
+  return x == y || (ISNAN(x) && ISNAN(y) && R_IsNA(x) == R_IsNA(y));
+}
+static inline int _eq_dbl_tol(struct _ctx *ctx, double x, double y) {
+  if(_eq_dbl(x, y)) return 1;
+  if(!R_FINITE(x) || !R_FINITE(y)) return 0;
+
+  double dif = fabs(x - y);
+  return dif <= ctx->tol_abs || dif <= ctx->tol_rel * fmax(fabs(x), fabs(y));
+}
+/* Instantiate the algorithm for each type, see "diff_tpl.h" */
+
+#define DIFF_T SEXP
+#define DIFF_EQ(ctx, x, y) ((x) == (y))
+#define DIFF_FN(name) name ## _chr
+#include "diff_tpl.h"
+
+#define DIFF_T int
+#define DIFF_EQ(ctx, x, y) ((x) == (y))
+#define DIFF_FN(name) name ## _int
+#include "diff_tpl.h"
+
+#define DIFF_T double
+#define DIFF_EQ(ctx, x, y) _eq_dbl((x), (y))
+#define DIFF_FN(name) name ## _dbl
+#include "diff_tpl.h"
+
+#define DIFF_T double
+#define DIFF_EQ(ctx, x, y) _eq_dbl_tol((ctx), (x), (y))
+#define DIFF_FN(name) name ## _dbl_tol
+#include "diff_tpl.h"
+
+#define DIFF_T Rbyte
+#define DIFF_EQ(ctx, x, y) ((x) == (y))
+#define DIFF_FN(name) name ## _raw
+#include "diff_tpl.h"
+
+/*
+ * Patience diff
+ *
+ * Elements that appear exactly once in each of `a` and `b` are used as
+ * anchors: we keep the longest sequence of such elements that appears in the
+ * same order in both (longest increasing subsequence of their `b` positions),
+ * and then repeat the process on each of the gaps between anchors, falling
+ * back to Myers for gaps without unique elements.  This is not guaranteed to
+ * produce a shortest edit script, but on inputs with many repeated elements
+ * (e.g. blank lines or braces in code) the result is often more readable,
+ * and much faster as Myers only ever sees the small gaps.
+ *
+ * To make uniqueness checks cheap we first map each element to an integer
+ * id such that elements are equal if and only if their ids are equal, and
+ * then diff the ids.  This is why patience is not available with numeric
+ * tolerances, as those do not define an equivalence relation.
+ */
+
+/*
+ * Compute a key for each element such that keys are equal if and only if
+ * elements are equal.  CHARSXPs are cached so we can use their addresses,
+ * and for doubles we need to normalize zeroes and NaNs.
+ */
+  static void
+_keys(struct _ctx *ctx, SEXP x, int off, int n, uint64_t *keys) {
+  switch(TYPEOF(x)) {
+    case STRSXP: {
+      const SEXP *x_p = STRING_PTR_RO(x) + off;
+      for(int i = 0; i < n; i++) keys[i] = (uint64_t)(uintptr_t) x_p[i];
+      break;
+    }
+    case INTSXP: {
+      const int *x_p = INTEGER(x) + off;
+      for(int i = 0; i < n; i++) keys[i] = (uint32_t) x_p[i];
+      break;
+    }
+    case REALSXP: {
+      const double *x_p = REAL(x) + off;
+      double val;
+      for(int i = 0; i < n; i++) {
+        val = x_p[i];
+        if(ISNAN(val)) val = R_IsNA(val) ? NA_REAL : R_NaN;
+        else if(val == 0) val = 0;  // -0 == 0
+        memcpy(keys + i, &val, sizeof(double));
+      }
+      break;
+    }
+    case RAWSXP: {
+      const Rbyte *x_p = RAW(x) + off;
+      for(int i = 0; i < n; i++) keys[i] = x_p[i];
+      break;
+    }
+    default:
+      _err(ctx, "Logic Error: unsupported type; contact maintainer."); // nocov
+  }
+}
+/*
+ * Map the elements of `a` and `b` to ids in 0..(number of distinct elements
+ * - 1) using an open addressing hash table on the element keys.  Ids for
+ * elements `aoff` through `aoff + n - 1` of `a` are written to `ida` starting
+ * at zero, and likewise for `b`.  Returns the number of distinct ids.
  */
   static int
-_ses(
-  SEXP a, int aoff, int n, SEXP b, int boff, int m, struct _ctx *ctx
+_ids(
+  struct _ctx *ctx, SEXP a, int aoff, int n, SEXP b, int boff, int m,
+  int *ida, int *idb
 ) {
-  R_CheckUserInterrupt();
-  struct middle_snake ms;
-  int d;
+  int shift = 64, size = 1;
+  while(size < 2 * (n + m) + 2) {
+    size *= 2;
+    shift--;
+  }
+  uint64_t *keys = (uint64_t *) _alloc(ctx, n > m ? n : m, sizeof(uint64_t));
+  uint64_t *tkeys = (uint64_t *) _alloc(ctx, size, sizeof(uint64_t));
+  int *tids = (int *) _alloc(ctx, size, sizeof(int));
+  for(int i = 0; i < size; i++) tids[i] = -1;
 
-  //Rprintf("m: %d n: %d\n", m, n);
-  if (n == 0) {
-    _edit(ctx, DIFF_INSERT, boff, m);
-    d = m;
-  } else if (m == 0) {
-    _edit(ctx, DIFF_DELETE, aoff, n);
-    d = n;
-  } else {
-    /* Find the middle "snake" around which we
-     * recursively solve the sub-problems.  Note this modifies `ms` by ref to
-     * set the beginning and end coordinates of the snake of the furthest
-     * reaching path.  The beginning is always the top left part of the snake,
-     * irrespective of whether it was found on a forward or reverse path as
-     * f_m_s will flip the coordinates when appropriately when recording them
-     * in `ms`
-     *
-     * Additionally, if diffs exceed max.diffs, then `faux.snake` will also
-     * be set.  `faux_snake` is a pointer to a pointer that points to a the
-     * beginning of an array of match/delete/insert instructions generated
-     * to connect the top left and bottom right paths. _fms() repoints the
-     * pointer to an updated edit list if needed via (_ffs())
-     */
-    diff_op fsv = DIFF_NULL;
-    diff_op * faux_snake;
-    faux_snake = &fsv;
-    //
-    // d
-    // diff_op * fsp = NULL;
-    // diff_op fsv = DIFF_NULL;
-    // *fsp = fsv;
-    // **faux_snake = *fsp;
-
-    d = _find_middle_snake(a, aoff, n, b, boff, m, ctx, &ms, &faux_snake);
-    //Rprintf("d: %d\n", d);
-    if (d == -1) {
-      // nocov start
-      error(
-        "Logic error: failed trying to find middle snake, contact maintainer."
-      );
-      // nocov end
-    } else if (ctx->ses == NULL) {
-      // nocov start
-      error(err_msg_ubrnch, 6);
-      return d;
-      // nocov end
-    } else if (d > 1) {
-      /* in this case we have something along the lines of (note the non-
-       * diagonal bits are just non-diagonal, we're making no claims about
-       * whether they should or could be of the horizontal variety)
-       * ... -
-       *      \
-       *       \
-       *        \- ...
-       * so we will record the snake (diagonal) in the middle, and recurse
-       * on the stub at the beginning and on the stub at the end separately
-       */
-
-      /* Beginning stub */
-
-      if (_ses(a, aoff, ms.x, b, boff, ms.y, ctx) == -1) {
-        // nocov start
-        error("Logic error: failed trying to run ses; contact maintainer.");
-        // nocov end
+  int nid = 0;
+  for(int k = 0; k < 2; k++) {
+    int len = k ? m : n;
+    int *ids = k ? idb : ida;
+    if(k) _keys(ctx, b, boff, m, keys); else _keys(ctx, a, aoff, n, keys);
+
+    for(int i = 0; i < len; i++) {
+      // fibonacci hashing
+      uint64_t h = (keys[i] * 0x9E3779B97F4A7C15ULL) >> shift;
+      while(tids[h] >= 0 && tkeys[h] != keys[i]) h = (h + 1) & (size - 1);
+      if(tids[h] < 0) {
+        tids[h] = nid++;
+        tkeys[h] = keys[i];
       }
-      /* Now record middle snake
-       *
-       * u should be x coord of end of snake of longest path
-       * v should be y coord of end of snake
-       * x, y should be coord of begining of snake
-       *
-       * record that there is a matching section between the beginning of the
-       * middle snake and the end
-       *
-       * if faux_snake is defined it means that there were too many differences
-       * to complete algorigthm normally so we need to record the faux snake
-       */
-      if(*faux_snake) {
-        /* for faux snake length of snake will most likely not be ms.u - ms.x
-         * since it will not be a diagonal
-         */
-        _edit_faux(ctx, faux_snake, aoff + ms.x, boff + ms.y);
-      } else {
-        _edit(ctx, DIFF_MATCH, aoff + ms.x, ms.u - ms.x);
+      ids[i] = tids[h];
+    }
+  }
+  return nid;
+}
+/* Work items for _patience; either a gap to diff, or a match to record */
+
+struct _pat_item {
+  int match;
+  int aoff, n, boff, m;
+};
+  static int
+_patience(
+  const int *a, int aoff, int n, const int *b, int boff, int m, int nid,
+  struct _ctx *ctx
+) {
+  int d = 0;
+  int k = n < m ? n : m;
+
+  _buf_init(ctx, n, m);
+
+  // Counts, and the position in `b` of unique elements; these are all zero
+  // between uses
+
+  int *cnta = (int *) _alloc(ctx, nid, sizeof(int));
+  int *cntb = (int *) _alloc(ctx, nid, sizeof(int));
+  int *posb = (int *) _alloc(ctx, nid, sizeof(int));
+
+  // Candidate anchors, and scratch for the longest increasing subsequence
+
+  int *canda = (int *) _alloc(ctx, k + 1, sizeof(int));
+  int *candb = (int *) _alloc(ctx, k + 1, sizeof(int));
+  int *tails = (int *) _alloc(ctx, k + 1, sizeof(int));
+  int *prev = (int *) _alloc(ctx, k + 1, sizeof(int));
+
+  // Each anchor generates at most a gap, a match, and a suffix match, so this
+  // is enough to hold all pending items
+
+  int stackmax = 5 * k + 8, si = 0;
+  struct _pat_item *stack = (struct _pat_item *)
+    _alloc(ctx, stackmax, sizeof(struct _pat_item));
+
+  stack[si++] = (struct _pat_item) {0, aoff, n, boff, m};
+
+  while(si) {
+    struct _pat_item it = stack[--si];
+    if(it.match) {
+      _edit(ctx, DIFF_MATCH, it.aoff, it.n);
+      continue;
+    }
+    const int *ap = a + it.aoff, *bp = b + it.boff;
+    int pre = 0, suf = 0;
+    int na = it.n, nb = it.m;
+
+    while(pre < na && pre < nb && ap[pre] == bp[pre]) pre++;
+    _edit(ctx, DIFF_MATCH, it.aoff, pre);
+    while(
+      suf < na - pre && suf < nb - pre &&
+      ap[na - 1 - suf] == bp[nb - 1 - suf]
+    ) suf++;
+
+    int a0 = it.aoff + pre, b0 = it.boff + pre;
+    na -= pre + suf;
+    nb -= pre + suf;
+
+    // Find elements unique in both sides of the gap
+
+    int nc = 0;
+    if(na && nb) {
+      for(int i = 0; i < na; i++) cnta[a[a0 + i]]++;
+      for(int j = 0; j < nb; j++) {
+        cntb[b[b0 + j]]++;
+        posb[b[b0 + j]] = b0 + j;
       }
-      /* Now recurse into the second stub */
-      aoff += ms.u;
-      boff += ms.v;
-      n -= ms.u;
-      m -= ms.v;
-      if (_ses(a, aoff, n, b, boff, m, ctx) == -1) {
-        // nocov start
-        error("Logic error: failed trying to run ses 2; contact maintainer.");
-        // nocov end
+      for(int i = 0; i < na; i++) {
+        int id = a[a0 + i];
+        if(cnta[id] == 1 && cntb[id] == 1) {
+          canda[nc] = a0 + i;
+          candb[nc] = posb[id];
+          nc++;
+      } }
+      for(int i = 0; i < na; i++) cnta[a[a0 + i]] = 0;
+      for(int j = 0; j < nb; j++) cntb[b[b0 + j]] = 0;
+    }
+    if(!nc) {
+      d += _ses_top_int(a, a0, na, b, b0, nb, ctx);
+      _edit(ctx, DIFF_MATCH, a0 + na, suf);
+      continue;
+    }
+    // Longest increasing subsequence of candidate `b` positions (patience
+    // sorting); `tails[l]` is the index of the candidate that ends the
+    // lowest ending increasing subsequence of length `l + 1`.
+
+    int nt = 0;
+    for(int c = 0; c < nc; c++) {
+      int lo = 0, hi = nt;
+      while(lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if(candb[tails[mid]] < candb[c]) lo = mid + 1; else hi = mid;
       }
-    } else {
-      int x = ms.x;
-      int u = ms.u;
-
-      /* There are only 4 base cases when the
-       * edit distance is 1.  Having a hard time finding cases that trigger the
-       * x == u, possibly because the algo eats leading matches, although
-       * apparently we do achieve it somewhere in the test suite.
-       *
-       * n > m   m > n
-       *
-       *   -       |
-       *    \       \    x != u
-       *     \       \
-       *
-       *   \       \
-       *    \       \    x == u
-       *     -       |
-       */
-
-      //Rprintf("x: %d u: %d y: %d v: %d\n",  ms.x, ms.u, ms.y, ms.v);
-      if (m > n) {
-        if (x == u) {
-          _edit(ctx, DIFF_MATCH, aoff, n);
-          _edit(ctx, DIFF_INSERT, boff + (m - 1), 1);
-        } else {
-          _edit(ctx, DIFF_INSERT, boff, 1);
-          _edit(ctx, DIFF_MATCH, aoff, n);
-        }
-      } else if (m < n) {
-        if (x == u) {
-          _edit(ctx, DIFF_MATCH, aoff, m);
-          _edit(ctx, DIFF_DELETE, aoff + (n - 1), 1);
-        } else {
-          _edit(ctx, DIFF_DELETE, aoff, 1);
-          _edit(ctx, DIFF_MATCH, aoff + 1, m);
+      prev[c] = lo ? tails[lo - 1] : -1;
+      tails[lo] = c;
+      if(lo == nt) nt++;
+    }
+    // Push items in reverse order so they are popped in order
+
+    if(si + 2 * nt + 2 > stackmax)
+      _err(ctx, "Logic Error: exceeded patience stack; contact maintainer.");  // nocov
+
+    if(suf) stack[si++] = (struct _pat_item) {1, a0 + na, suf, b0 + nb, suf};
+
+    int a1 = a0 + na, b1 = b0 + nb;
+    for(int c = tails[nt - 1]; c >= 0; c = prev[c]) {
+      int ca = canda[c], cb = candb[c];
+      if(a1 - ca - 1 || b1 - cb - 1)
+        stack[si++] =
+          (struct _pat_item) {0, ca + 1, a1 - ca - 1, cb + 1, b1 - cb - 1};
+      stack[si++] = (struct _pat_item) {1, ca, 1, cb, 1};
+      a1 = ca;
+      b1 = cb;
+    }
+    if(a1 - a0 || b1 - b0)
+      stack[si++] = (struct _pat_item) {0, a0, a1 - a0, b0, b1 - b0};
+  }
+  return d;
+}
+/*
+ * Bit-parallel LCS (Allison and Dix, Hyyrö) for inputs where the shorter of
+ * `a` and `b` has at most DIFF_BP_MAX elements.
+ *
+ * Each element of the longer vector updates a bit vector with one bit per
+ * element of the shorter one, so the cost is O(n * m / 64) whatever the
+ * number of differences, without the recursion and buffers of the Myers
+ * search.  We keep the bit vector for each suffix of the longer vector (row),
+ * from which we can count the LCS of any pair of suffixes, and so walk an
+ * optimal path from the top left of the edit graph.  Along it we take matches
+ * where possible, and deletions over insertions otherwise, and record the
+ * deletions in a gap between matches before the insertions.  Among equally
+ * short edit scripts this does not always pick the one the Myers search
+ * would, which is why this is a separate algorithm.
+ *
+ * With `unique` the result is only used if the LCS is the only one, as then
+ * every shortest edit script has the same matches as ours, including the one
+ * the Myers algorithm would find.  The walks that skip elements of `b`, or of
+ * `a`, whenever that keeps the path optimal find the two extreme LCSs, with
+ * all others between them, so they differ if and only if the LCS is not
+ * unique.  The deletions and insertions between matches may still be in a
+ * different order than with Myers.
+ *
+ * Returns the edit distance, or -1 if the inputs are too long, are doubles
+ * compared with a tolerance (equality is not transitive so we can't map them
+ * to ids), the edit distance reaches `max.diffs`, or with `unique` the LCS is
+ * not unique; in that case nothing was recorded and the caller should use the
+ * Myers algorithm.  The longer input is limited to DIFF_BP_ROWS elements as
+ * we keep a row for each of its elements.
+ */
+#define DIFF_BP_WORDS 4
+#define DIFF_BP_MAX (64 * DIFF_BP_WORDS)
+#define DIFF_BP_ROWS 65536
+
+  static inline int
+_popcount(uint64_t x)
+{
+#ifdef __GNUC__
+  return __builtin_popcountll(x);
+#else
+  int c = 0;
+  for(; x; c++) x &= x - 1;
+  return c;
+#endif
+}
+// LCS recorded in the first `q` bits of a row
+
+  static inline int
+_bp_lcs(const uint64_t *row, int q)
+{
+  int c = 0, w = 0;
+  for(; q >= 64; q -= 64, w++) c += _popcount(~row[w]);
+  if(q) c += _popcount(~row[w] & ((UINT64_C(1) << q) - 1));
+  return c;
+}
+  static int
+_bitpar(struct _ctx *ctx, int aoff, int n, int boff, int m, int unique)
+{
+  if(
+    (n < m ? n : m) > DIFF_BP_MAX || (n < m ? m : n) > DIFF_BP_ROWS ||
+    ctx->tol_abs > 0 || ctx->tol_rel > 0
+  )
+    return -1;
+
+  int *ida = (int *) _alloc(ctx, n + 1, sizeof(int));
+  int *idb = (int *) _alloc(ctx, m + 1, sizeof(int));
+  int nid = _ids(ctx, ctx->a, aoff, n, ctx->b, boff, m, ida, idb);
+
+  // With `unique` the common suffix is only taken out when the Myers search
+  // would also do so (see `_diff`), as otherwise it can use it differently
+
+  int pre = 0, suf = 0;
+  while(pre < n && pre < m && ida[pre] == idb[pre]) pre++;
+  if(!unique || n + m - 2 * pre >= DIFF_PREP_MIN) while(
+    suf < n - pre && suf < m - pre && ida[n - 1 - suf] == idb[m - 1 - suf]
+  ) suf++;
+
+  int na = n - pre - suf, nb = m - pre - suf;
+  const int *xa = ida + pre, *xb = idb + pre;
+
+  // Rows are indexed by suffixes of the longer side, bits by suffixes of the
+  // shorter one, with bit `t` standing for the `t`th element from the end
+
+  int along = na >= nb;
+  const int *xl = along ? xa : xb, *xs = along ? xb : xa;
+  int nl = along ? na : nb, ns = along ? nb : na;
+  int nw = ns ? (ns + 63) / 64 : 1;
+
+  uint64_t *pm = (uint64_t *) _alloc(ctx, (size_t) nid * nw, sizeof(uint64_t));
+  uint64_t *rows =
+    (uint64_t *) _alloc(ctx, (size_t) (nl + 1) * nw, sizeof(uint64_t));
+  for(int t = 0; t < ns; t++)
+    pm[(size_t) xs[ns - 1 - t] * nw + t / 64] |= UINT64_C(1) << (t % 64);
+  for(int w = 0; w < nw; w++) rows[w] = ~UINT64_C(0);
+
+  for(int r = 1; r <= nl; r++) {
+    const uint64_t *prev = rows + (size_t) (r - 1) * nw;
+    const uint64_t *match = pm + (size_t) xl[nl - r] * nw;
+    uint64_t *cur = rows + (size_t) r * nw;
+    uint64_t carry = 0;
+    for(int w = 0; w < nw; w++) {
+      uint64_t u = prev[w] & match[w];
+      uint64_t sum = prev[w] + u;
+      uint64_t c = sum < u;
+      sum += carry;
+      carry = c | (sum < carry);
+      cur[w] = sum | (prev[w] & ~u);
+    }
+  }
+  int lcs = _bp_lcs(rows + (size_t) nl * nw, ns);
+  int d = na + nb - 2 * lcs;
+  if(d >= ctx->dmax) return -1;
+
+  // LCS of a[i:] and b[j:] (net of prefix)
+
+#define BP_LCS(i, j) (along ?                                           \
+  _bp_lcs(rows + (size_t) (na - (i)) * nw, nb - (j)) :                  \
+  _bp_lcs(rows + (size_t) (nb - (j)) * nw, na - (i)))
+
+  int i = 0, j = 0, gi = 0, gj = 0;
+  if(unique && lcs) {
+    int *mi = (int *) _alloc(ctx, lcs, sizeof(int));
+    int *mj = (int *) _alloc(ctx, lcs, sizeof(int));
+    for(int k = 0; k < lcs;) {
+      if(BP_LCS(i, j + 1) == lcs - k) j++;
+      else if(xa[i] == xb[j]) {mi[k] = i++; mj[k++] = j++;}
+      else i++;
+    }
+    i = j = 0;
+    for(int k = 0; k < lcs;) {
+      if(BP_LCS(i + 1, j) == lcs - k) i++;
+      else if(xa[i] == xb[j]) {
+        if(mi[k] != i || mj[k] != j) return -1;
+        i++; j++; k++;
+      } else j++;
+    }
+    i = j = 0;
+  }
+  aoff += pre;
+  boff += pre;
+  _edit(ctx, DIFF_MATCH, aoff - pre, pre);
+  while(i < na || j < nb) {
+    if(i < na && j < nb && xa[i] == xb[j]) {
+      _edit(ctx, DIFF_DELETE, aoff + gi, i - gi);
+      _edit(ctx, DIFF_INSERT, boff + gj, j - gj);
+      _edit(ctx, DIFF_MATCH, aoff + i, 1);
+      gi = ++i;
+      gj = ++j;
+    } else if(i < na && BP_LCS(i + 1, j) == BP_LCS(i, j)) {
+      i++;
+    } else j++;
+  }
+#undef BP_LCS
+
+  _edit(ctx, DIFF_DELETE, aoff + gi, na - gi);
+  _edit(ctx, DIFF_INSERT, boff + gj, nb - gj);
+  _edit(ctx, DIFF_MATCH, aoff + na, suf);
+  return d;
+}
+/*
+ * Discard elements that have no counterpart in the other vector.
+ *
+ * Such elements are necessarily deleted or inserted, so we can take them out
+ * of the Myers search, which both reduces the size of the buffer and the
+ * number of differences the search has to go through (this is what GNU diff
+ * does in `discard_confusing_lines`).  We then run the search on the
+ * remaining elements and map the result back to the original positions,
+ * recording all deletions in a gap between matches before the insertions.
+ *
+ * Returns the edit distance, or -1 if nothing was discarded, discarding is
+ * not possible (numeric tolerances), or the discarded elements alone reach
+ * `dmax`, in which case the caller should run the search on the original
+ * vectors.
+ */
+  static int
+_discard(struct _ctx *ctx, int aoff, int n, int boff, int m)
+{
+  if(!n || !m || ctx->tol_abs > 0 || ctx->tol_rel > 0) return -1;
+
+  int *ida = (int *) _alloc(ctx, n, sizeof(int));
+  int *idb = (int *) _alloc(ctx, m, sizeof(int));
+  int nid = _ids(ctx, ctx->a, aoff, n, ctx->b, boff, m, ida, idb);
+
+  char *ina = (char *) _alloc(ctx, nid, sizeof(char));
+  char *inb = (char *) _alloc(ctx, nid, sizeof(char));
+  for(int i = 0; i < n; i++) ina[ida[i]] = 1;
+  for(int j = 0; j < m; j++) inb[idb[j]] = 1;
+
+  // Compact the kept elements, recording their original positions
+
+  int nk = 0, mk = 0;
+  int *amap = (int *) _alloc(ctx, n, sizeof(int));
+  int *bmap = (int *) _alloc(ctx, m, sizeof(int));
+  for(int i = 0; i < n; i++) if(inb[ida[i]]) {
+    ida[nk] = ida[i];
+    amap[nk++] = aoff + i;
+  }
+  for(int j = 0; j < m; j++) if(ina[idb[j]]) {
+    idb[mk] = idb[j];
+    bmap[mk++] = boff + j;
+  }
+  // The discarded elements count towards `dmax`, so the search is only
+  // allowed what is left of it; if there is nothing left we search the
+  // original vectors so that the limit applies as it would without discarding
+
+  int disc = (n - nk) + (m - mk), dmax = ctx->dmax;
+  if(!disc || disc >= dmax) return -1;
+
+  // Diff the kept elements into a temporary edit script.  Discarding can
+  // leave matches at either end; the search trims the leading ones and we
+  // trim the trailing ones.
+
+  struct diff_edit *ses = ctx->ses;
+  int si = ctx->si, simax = ctx->simax;
+  ctx->dmax = dmax - disc;
+  struct diff_edit *ses_k = (struct diff_edit *)
+    _alloc(ctx, nk + mk + 1, sizeof(struct diff_edit));
+  ses_k->op = 0;
+  ctx->ses = ses_k;
+  ctx->si = 0;
+  ctx->simax = nk + mk;
+
+  int s = 0, d;
+  while (s < nk && s < mk && ida[nk - 1 - s] == idb[mk - 1 - s]) s++;
+  _buf_init(ctx, nk - s, mk - s);
+  d = _ses_top_int(ida, 0, nk - s, idb, 0, mk - s, ctx);
+  _edit(ctx, DIFF_MATCH, nk - s, s);
+
+  int sn = ses_k->op ? ctx->si + 1 : 0;
+  ctx->ses = ses;
+  ctx->si = si;
+  ctx->simax = simax;
+  ctx->dmax = dmax;
+
+  // Replay the matches in original coordinates
+
+  int i = aoff, j = boff, x = 0, y = 0;
+  for(int k = 0; k < sn; k++) {
+    struct diff_edit *e = ses_k + k;
+    switch(e->op) {
+      case DIFF_MATCH:
+        for(int l = 0; l < e->len; l++) {
+          int xo = amap[x++], yo = bmap[y++];
+          _edit(ctx, DIFF_DELETE, i, xo - i);
+          _edit(ctx, DIFF_INSERT, j, yo - j);
+          _edit(ctx, DIFF_MATCH, xo, 1);
+          i = xo + 1;
+          j = yo + 1;
         }
+        break;
+      case DIFF_DELETE: x += e->len; break;
+      case DIFF_INSERT: y += e->len; break;
+      default:
+        _err(ctx, "Logic Error: unexpected edit in discard; contact maintainer."); // nocov
+    }
+  }
+  _edit(ctx, DIFF_DELETE, i, aoff + n - i);
+  _edit(ctx, DIFF_INSERT, j, boff + m - j);
+
+  return d + disc;
+}
+/*
+ * Run the requested algorithm on the requested type
+ */
+  static int
+_diff_dispatch(
+  SEXP a, int aoff, int n, SEXP b, int boff, int m, diff_algo algo,
+  struct _ctx *ctx
+) {
+  int d = 0;
+  if(
+    (algo == DIFF_ALGO_BITPAR || algo == DIFF_ALGO_AUTO) &&
+    (d = _bitpar(ctx, aoff, n, boff, m, algo == DIFF_ALGO_AUTO)) >= 0
+  )
+    return d;
+  if(
+    algo == DIFF_ALGO_PATIENCE &&
+    !(TYPEOF(a) == REALSXP && (ctx->tol_abs > 0 || ctx->tol_rel > 0))
+  ) {
+    int *ida = (int *) _alloc(ctx, aoff + n + 1, sizeof(int));
+    int *idb = (int *) _alloc(ctx, boff + m + 1, sizeof(int));
+    int nid = _ids(ctx, a, aoff, n, b, boff, m, ida + aoff, idb + boff);
+    d = _patience(ida, aoff, n, idb, boff, m, nid, ctx);
+  } else switch(TYPEOF(a)) {
+    case STRSXP:
+      d = _diff_chr(
+        STRING_PTR_RO(a), aoff, n, STRING_PTR_RO(b), boff, m, ctx
+      );
+      break;
+    case INTSXP:
+      d = _diff_int(INTEGER(a), aoff, n, INTEGER(b), boff, m, ctx);
+      break;
+    case REALSXP:
+      if(ctx->tol_abs > 0 || ctx->tol_rel > 0) {
+        d = _diff_dbl_tol(REAL(a), aoff, n, REAL(b), boff, m, ctx);
       } else {
-        // Should never get here since this should be a D 2 case
-        // nocov start
-        error(
-          "Very special case n %d m %d aoff %d boff %d u %d\n", n, m,
-          aoff, boff, ms.u
-        );
-        // nocov end
+        d = _diff_dbl(REAL(a), aoff, n, REAL(b), boff, m, ctx);
       }
-    }
+      break;
+    case RAWSXP:
+      d = _diff_raw(RAW(a), aoff, n, RAW(b), boff, m, ctx);
+      break;
+    default:
+      _err(ctx, "Logic Error: unsupported type; contact maintainer."); // nocov
   }
   return d;
 }
 /*
+ * Check the arguments and run the diff
+ */
+  static int
+_diff_run(
+  SEXP a, int aoff, int n, SEXP b, int boff, int m, diff_algo algo,
+  int *sn, struct _ctx *ctx
+) {
+  if(n < 0 || m < 0)
+    _err(ctx, "Logic Error: negative lengths; contact maintainer.");  // nocov
+  if(TYPEOF(a) != TYPEOF(b))
+    _err(ctx, "Logic Error: mismatched vector types; contact maintainer.");  // nocov
+  if(sn && !ctx->ses)
+    _err(ctx, "Logic Error: specifying sn, but ses is NULL, contact maintainer.");  // nocov
+
+  /* initialize first ses edit struct*/
+  if (ctx->ses && sn) ctx->ses->op = 0;
+
+  return _diff_dispatch(a, aoff, n, b, boff, m, algo, ctx);
+}
+/*
+ * `_diff_run` in worker mode, where errors `longjmp` back here.  Nothing
+ * local to this function changes after `setjmp`, and `ctx` belongs to the
+ * caller, so everything has its expected value after the jump.
+ */
+  static int
+_diff_worker(
+  SEXP a, int aoff, int n, SEXP b, int boff, int m, diff_algo algo,
+  int *sn, struct _ctx *ctx
+) {
+  jmp_buf jmp;
+  ctx->jmp = &jmp;
+  if(setjmp(jmp)) return INT_MIN;
+  return _diff_run(a, aoff, n, b, boff, m, algo, sn, ctx);
+}
+/*
+ * - a and b are the vectors to diff; they must be of the same type, one of
+ *   STRSXP, INTSXP, REALSXP, or RAWSXP
  * - ses is a pointer to an array of diff_edit structs that is initialized
  *   outside of this call
  * - aoff and boff are how far we've moved across the strings, used mostly in the
  *   context of recursion for _ses
  * - n is the lenght of a, m the length of b
+ * - context is NULL, or a pointer to a `struct diff_opts` with the algorithm
+ *   to use and the tolerances to use when comparing REALSXP elements
+ *
+ * If `context` is a `struct diff_opts` with `worker` set, `diff` may be called
+ * from a thread other than R's main thread.  In that case it does not use the
+ * R API, and on error it records the message in the `errmsg` member of the
+ * options and returns INT_MIN.
  */
   int
 diff(SEXP a, int aoff, int n, SEXP b, int boff, int m,
   void *context, int dmax, struct diff_edit *ses, int *sn
 ) {
-  if(n < 0 || m < 0)
-    error("Logic Error: negative lengths; contact maintainer.");  // nocov
   struct _ctx ctx;
-  int d, x, y;
-  struct diff_edit *e = NULL;
-  int delta = n - m;
-  if(delta < 0) delta = -delta;
-  int bufmax = 4 * (n + m + delta) + 1;  // see _setv
-  if(bufmax < n || bufmax < m)
-    error("Logic Error: exceeded maximum allowable combined string length.");  // nocov
-
-  int *tmp = (int *) R_alloc(bufmax, sizeof(int));
-  for(int i = 0; i < bufmax; i++) *(tmp + i) = 0;
+  int d;
+  struct diff_opts *opts = (struct diff_opts *) context;
 
   ctx.context = context;
+  ctx.a = a;
+  ctx.b = b;
 
-  /* initialize buffer
+  /* buffer is allocated once we know the size of the problem, see _buf_init
    */
-  ctx.buf = tmp;
-  ctx.bufmax = bufmax;
+  ctx.buf = ctx.fv = ctx.rv = NULL;
+  ctx.bufcap = ctx.vmax = 0;
+  ctx.vhw = -1;
+  ctx.ws = NULL;
+  ctx.faux = NULL;
+  ctx.fauxtop = ctx.fauxcap = 0;
   ctx.ses = ses;
   ctx.si = 0;
   ctx.simax = n + m;
   ctx.dmax = dmax ? dmax : INT_MAX;
   ctx.dmaxhit = 0;
+  ctx.tol_abs = ctx.tol_rel = 0;
+  ctx.threads = 1;
+  ctx.par = 0;
+  ctx.jmp = NULL;
+  ctx.allocs = NULL;
+  ctx.errmsg[0] = 0;
+  ctx.intr = NULL;
 
-  /* initialize first ses edit struct*/
-  if (ses && sn) {
-    if ((e = ses) == NULL) {
-      error("Logic Error: specifying sn, but ses is NULL, contact maintainer.");  // nocov
+  diff_algo algo = DIFF_ALGO_MYERS;
+  if(opts) {
+    ctx.tol_abs = opts->tol_abs;
+    ctx.tol_rel = opts->tol_rel;
+    algo = opts->algo;
+    if((ctx.ws = opts->ws)) {
+      // Mark the whole buffer as dirty until we exit normally
+      ctx.buf = ctx.ws->buf;
+      ctx.bufcap = ctx.ws->bufcap;
+      ctx.vmax = ctx.ws->vmax;
+      ctx.vhw = ctx.ws->vhw;
+      if(ctx.buf && ctx.vmax >= 0) {
+        ctx.fv = ctx.buf + ctx.vmax;
+        ctx.rv = ctx.buf + 3 * ctx.vmax + 1;
+      }
+      ctx.ws->vmax = -1;
     }
-    e->op = 0;
-  }
-
-  /* The _ses function assumes the SES will begin or end with a delete
-   * or insert. The following will ensure this is true by eating any
-   * beginning matches. This is also a quick to process sequences
-   * that match entirely.
-   */
-  x = y = 0;
-  while (
-    x < n && y < m && _comp_chr(a, aoff + x, b, boff + y)
-  ) {
-    x++; y++;
-    if(boff + y < boff + y - 1 || aoff + x < aoff + x - 1)
-      error("Logic Error: exceeded int size 45823; contact maintainer");  // nocov
+    if(opts->worker) {
+      ctx.par = 1;
+      ctx.intr = opts->intr;
+    } else ctx.threads = opts->threads;
   }
-  _edit(&ctx, DIFF_MATCH, aoff, x);
+  if(ctx.par) {
+    d = _diff_worker(a, aoff, n, b, boff, m, algo, sn, &ctx);
+    if(d == INT_MIN) {
+      memcpy(opts->errmsg, ctx.errmsg, sizeof(ctx.errmsg));
+      _free_allocs(ctx.allocs);
+      return INT_MIN;
+    }
+  } else d = _diff_run(a, aoff, n, b, boff, m, algo, sn, &ctx);
 
-  d = _ses(a, aoff + x, n - x, b, boff + y, m - y, &ctx);
   if (ses && sn) {
-    *sn = e->op ? ctx.si + 1 : 0;
+    *sn = ses->op ? ctx.si + 1 : 0;
   }
+  if(ctx.ws) {
+    ctx.ws->vmax = ctx.vmax;
+    ctx.ws->vhw = ctx.vhw;
+  }
+  _free_allocs(ctx.allocs);
   return d * (ctx.dmaxhit ? -1 : 1);
 }
-
@@ -69,6 +69,47 @@ struct diff_edit {
 	int len;
 };
 
+/* DIFF_ALGO_AUTO finds the same matches as Myers, but with the bit-parallel
+ * algorithm when that is known to give the same ones; the order of deletions
+ * and insertions between matches may differ
+ */
+typedef enum {
+	DIFF_ALGO_MYERS = 0,
+	DIFF_ALGO_PATIENCE,
+	DIFF_ALGO_BITPAR,
+	DIFF_ALGO_AUTO
+} diff_algo;
+
+/* memory that may be reused across calls to diff to avoid allocating and
+ * clearing it each time; must be zero initialized, and released with
+ * diff_ws_free
+ */
+struct diff_ws {
+	int *buf;        /* V buffer, all zero past diagonal `vhw`, see _buf_init */
+	int bufcap;
+	int vmax;
+	int vhw;
+	struct diff_edit *ses;
+	int sescap;
+	diff_op *faux;   /* faux snake scratch */
+	int fauxcap;
+};
+
+/* optional settings passed to diff via `context`; REALSXP elements match if
+ * they are within either tolerance
+ */
+struct diff_opts {
+	double tol_abs;
+	double tol_rel;  /* relative to the larger magnitude of the two */
+	diff_algo algo;
+	int threads;     /* max threads, only used if compiled with OpenMP */
+	int worker;      /* called from a worker thread, see `diff` */
+	int *intr;       /* worker: NULL, or flag shared by the workers that is set
+	                  * once the user interrupts them */
+	struct diff_ws *ws;  /* NULL, or workspace to use */
+	char errmsg[256];
+};
+
 /* consider alternate behavior for each NULL parameter
  */
 int diff(SEXP a, int aoff, int n,
@@ -76,6 +117,8 @@ int diff(SEXP a, int aoff, int n,
   void *context, int dmax,
   struct diff_edit *ses, int *sn
 );
+struct diff_edit *diff_ws_ses(struct diff_ws *ws, int n);
+void diff_ws_free(struct diff_ws *ws);
 
 #ifdef __cplusplus
 }
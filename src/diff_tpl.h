@@ -0,0 +1,736 @@
+/*
+ * This file is part of a program that contains a heavily modified version of
+ * Michael B. Allen implementation of the Myers diff algorithm.  This
+ * implementation is not compatible with the original one.  See next
+ * comment blocks for original copyright and license information.
+ *
+ * Copyright (C) 2018  Brodie Gaslam
+ *
+ * This file is part of "diffobj - Diffs for R Objects"
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
+ */
+/* ORIGINAL COPYRIGHT NOTICE:
+ *
+ * diff - compute a shortest edit script (SES) given two sequences
+ * Copyright (c) 2004 Michael B. Allen <mba2000 ioplex.com>
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/*
+ * Type generic implementation of the Myers algorithm.
+ *
+ * This file is not a normal header: it is included by "diff.c" once for each
+ * vector type we support (note no include guard), with the following macros
+ * defined beforehand:
+ *
+ * - DIFF_T: the C type of the vector elements (e.g. `int` for INTSXP)
+ * - DIFF_EQ(ctx, x, y): expression that evaluates to non-zero if elements `x`
+ *   and `y` are equal; `ctx` is the `struct _ctx *` for the diff in progress
+ *   so that comparisons may use parameters such as numeric tolerances.  It
+ *   must be true for elements with the same bit pattern, see _snake_fwd
+ * - DIFF_FN(name): produces the type specific name of each function
+ *
+ * The point of this is to allow the compiler to inline the comparisons in the
+ * snake walks, which are the hot loops of the algorithm.  See "diff.c" for
+ * the type independent helper functions and the documentation of the overall
+ * algorithm.  All the macros are undefined at the end of this file.
+ */
+
+/*
+ * Length of the snake starting at `a[0]` and `b[0]` and running for at most
+ * `n` elements (_snake_fwd), or ending just before them (_snake_rev).
+ *
+ * Identical bytes imply equal elements, so after each match we skip ahead with
+ * the vectorized byte comparison (see _run_fwd), and only use DIFF_EQ to
+ * decide about the element where the bytes first differ.  For pointers,
+ * integers, and raw values that is the end of the snake, but doubles may still
+ * be equal (e.g. 0 and -0, or within tolerance), in which case we continue.
+ */
+  static inline int
+DIFF_FN(_snake_fwd)(
+  const DIFF_T *a, const DIFF_T *b, int n, struct _ctx *ctx
+) {
+  int i = 0;
+  (void) ctx;  // not all types use it
+  while(i < n && DIFF_EQ(ctx, a[i], b[i])) {
+    i++;
+    i += (int) (
+      _run_fwd(
+        (const unsigned char *) (a + i), (const unsigned char *) (b + i),
+        (size_t) (n - i) * sizeof(DIFF_T)
+      ) / sizeof(DIFF_T)
+    );
+  }
+  return i;
+}
+  static inline int
+DIFF_FN(_snake_rev)(
+  const DIFF_T *a, const DIFF_T *b, int n, struct _ctx *ctx
+) {
+  int i = 0;
+  (void) ctx;
+  while(i < n && DIFF_EQ(ctx, a[-1 - i], b[-1 - i])) {
+    i++;
+    i += (int) (
+      _run_rev(
+        (const unsigned char *) (a - i), (const unsigned char *) (b - i),
+        (size_t) (n - i) * sizeof(DIFF_T)
+      ) / sizeof(DIFF_T)
+    );
+  }
+  return i;
+}
+/*
+ * Handle cases where differences exceed maximum allowable differences
+ *
+ * General logic is to create a faux snake that instead of moving down
+ * diagonally will chain right and down moves until it hits a path coming
+ * from the other direction.  This snake is stored in `ctx`, and is then
+ * written by `ses` to the `ses` list.
+ */
+static int
+DIFF_FN(_find_faux_snake)(
+  const DIFF_T *a, int aoff, int n, const DIFF_T *b, int boff, int m, struct _ctx *ctx,
+  struct middle_snake *ms, int d, diff_op ** faux_snake
+) {
+  /* normally we would record k/x values at the end of the furthest reaching
+   * snake, but here we need pick a path from top left  and extend it until
+   * we hit something coming from bottom right.
+   */
+  /* start by finding which diagonal has the furthest reaching value
+   * when looking from top left
+   */
+  int k_max_f = 0, x_max_f = -1;
+  int x_f, y_f, k_f;
+  int delta = n - m;
+
+  for (int k = d - 1; k >= -d + 1; k -= 2) { /* might need to shift by 1 */
+    int x_f = FV(k);
+    int f_dist = x_f - abs(k);
+
+    if(x_f > n || x_f - k > m) continue;
+
+    if(f_dist > x_max_f - abs(k_max_f)) {
+      x_max_f = x_f;
+      k_max_f = k;
+    }
+  }
+  /* didn't find a path so use origin */
+  if(x_max_f < 0) {
+    // nocov start
+    _err(ctx, err_msg_ubrnch, 2);
+    x_f = y_f = k_f = 0;
+    // nocov end
+  } else {
+    k_f = k_max_f;
+    x_f = x_max_f;
+    y_f = x_f - k_max_f;
+  }
+  /*
+   * now look for the furthest reaching point in any diagonal that is
+   * below the diagonal we found above since those are the only ones we
+   * can connect to
+   *
+   */
+  int k_max_r = 0, x_max_r = n + 1;
+  int x_r, y_r;
+
+  for (int k = -d; k <= k_max_f - delta; k += 2) {
+    int x_r = RV(k);
+    int r_dist = n - x_r - abs(k);
+    /* skip reverse snakes that overshoot our forward snake
+     * ---\
+     *     \
+     *   \
+     *    \
+     *     \---
+     * where there should be a decent path we can use, but because we are only
+     * tracking the last coordinates we don't really have a way connecting this
+     * type of path so we just go straight to the origin even though that is
+     * even more sub-optinal; not even sure if this is a possible scenario
+     */
+    if(x_r < x_f || x_r - k - delta < y_f) continue;
+
+    /* since buffer is init to zero, an x_r value of zero means nothing, and
+     * not all the way to the left of the graph; also, in reverse snakes the
+     * snake should end at x == 1 in the leftmost case (we think)
+     */
+    if(r_dist > n - x_max_r - abs(k_max_r) && x_r) {
+      x_max_r = x_r;
+      k_max_r = k;
+    }
+  }
+  if(x_max_r >= n) {
+    x_r = n; y_r = m;
+  } else {
+    x_r = x_max_r;
+    /* not 100% sure about this one; seems like k_max_r is relative to the
+     * bottom right origin, so maybe this should be x_r - k_max_r - delta?
+     */
+    y_r = x_r - k_max_r - delta;
+  }
+  /*
+   * attempt to connect the two paths we found.  We need to store this
+   * information as our "faux" snake since it will have to be processed
+   * in a manner similar as the middle snake would be processed; start by
+   * figuring out max number of steps it would take to connect the two
+   * paths
+   */
+  int max_steps = x_r - x_f + y_r - y_f + 1;
+  int steps = 0;
+  int diffs = 0;
+  int step_dir = 1; /* last direction we moved in, 1 is down */
+  int x_sn = x_f, y_sn = y_f;
+
+  /* initialize the fake snake */
+  if(max_steps < 0)
+    _err(ctx, "Logic Error: fake snake step overflow? Contact maintainer."); // nocov
+
+  diff_op * faux_snake_tmp;
+  int arena = ctx->faux && ctx->fauxtop + max_steps <= ctx->fauxcap;
+  if(arena) faux_snake_tmp = ctx->faux + ctx->fauxtop;
+  else faux_snake_tmp = (diff_op*) _alloc(ctx, max_steps, sizeof(diff_op));
+
+  /* we have a further reaching reverse snake:
+   * not entirely sure if this should happen, but it seems it does
+   */
+  while(x_sn < x_r || y_sn < y_r) {
+    if(x_sn > x_r || y_sn > y_r) {
+      _err(ctx, "Logic Error: Exceeded buffer for finding fake snake; contact maintainer.");  // nocov
+    }
+    /* check to see if we could possibly move on a diagonal, and do so
+     * if possible, if not alternate going down and right*/
+    if(
+        x_sn < x_r && y_sn < y_r &&
+        DIFF_EQ(ctx, a[aoff + x_sn], b[boff + y_sn])
+    ) {
+      x_sn++; y_sn++;
+      *(faux_snake_tmp + steps) = DIFF_MATCH;
+    } else if (x_sn < x_r && (step_dir || y_sn >= y_r)) {
+      x_sn++;
+      diffs++;
+      step_dir = !step_dir;
+      *(faux_snake_tmp + steps) = DIFF_DELETE;
+    } else if (y_sn < y_r && (!step_dir || x_sn >= x_r)) {
+      y_sn++;
+      diffs++;
+      *(faux_snake_tmp + steps) = DIFF_INSERT;
+      step_dir = !step_dir;
+    } else {
+      _err(ctx, "Logic Error: unexpected outcome in snake creation process; contact maintainer"); // nocov
+    }
+    steps++;
+  }
+  /* corner cases; must absolutely make sure steps LT max_steps since we rely
+   * on at least one zero at the end of the faux_snake when we read it to know
+   * to stop reading it
+   */
+  if(x_sn != x_r || y_sn != y_r || steps >= max_steps) {
+    _err(ctx, "Logic Error: faux snake process failed; contact maintainer."); // nocov
+  }
+  *(faux_snake_tmp + steps) = DIFF_NULL;
+  if(arena) ctx->fauxtop += steps + 1;
+  /* modify the pointer to the pointer so we can return in by ref */
+
+  *faux_snake = faux_snake_tmp;
+
+  /* record the coordinates of our faux snake using `ms` */
+  ms->x = x_f;
+  ms->y = y_f;
+  ms->u = x_r;
+  ms->v = y_r;
+
+  return diffs;
+}
+
+
+/*
+ * Advance from both ends of the diff graph toward center until we reach
+ * up to half of the maximum possible number of differences between
+ * a and b (note that `n` is net of `aoff`).  As we process this we record the
+ * end points of each path we explored in the `ctx` structure.  Once we reach
+ * the maximum number of differences, we return to `_ses` with the number of
+ * differences found.  `_ses` will then attempt to stitch back the snakes
+ * together.
+ */
+  static int
+DIFF_FN(_find_middle_snake)(
+  const DIFF_T *a, int aoff, int n, const DIFF_T *b, int boff, int m, struct _ctx *ctx,
+  struct middle_snake *ms, diff_op ** faux_snake
+) {
+  int delta, odd, mid, d, vhw;
+
+  delta = n - m;
+  odd = delta & 1;
+  mid = (n + m) / 2;
+  mid += odd;
+
+  /* Diagonals we write to are within `d + |delta| + 1` of zero, so we only
+   * need to track the extent once per `d`, see _buf_init
+   */
+  vhw = (delta < 0 ? -delta : delta) + 1;
+  if(vhw > ctx->vhw) ctx->vhw = vhw < ctx->vmax ? vhw : ctx->vmax;
+  FV(1) = 0;
+  RV(delta - 1) = n;
+
+  /* For each number of differences `d`, compute the farthest reaching paths
+   * from both the top left and bottom right of the edit graph
+   */
+  for (d = 0; d <= mid; d++, vhw++) {
+    int k, x, y;
+
+    if(vhw > ctx->vhw) ctx->vhw = vhw < ctx->vmax ? vhw : ctx->vmax;
+
+    /* reached maximum allowable differences before real exit condition*/
+    if ((2 * d - 1) >= ctx->dmax) {
+      ctx->dmaxhit = 1;
+      return DIFF_FN(_find_faux_snake)(
+        a, aoff, n, b, boff, m, ctx, ms, d, faux_snake
+      );
+    }
+    /* Forward (from top left) paths*/
+
+    for (k = d; k >= -d; k -= 2) {
+      if (k == -d || (k != d && FV(k - 1) < FV(k + 1))) {
+        x = FV(k + 1);
+      } else {
+        x = FV(k - 1) + 1;
+      }
+      y = x - k;
+
+      ms->x = x;
+      ms->y = y;
+      if(x < n && y < m) {
+        /* matching characters, just walk down diagonal */
+        int s = DIFF_FN(_snake_fwd)(
+          a + aoff + x, b + boff + y, n - x < m - y ? n - x : m - y, ctx
+        );
+        x += s; y += s;
+      }
+      FV(k) = x;
+
+      /* for this diagonal we (think we) are now at farthest reaching point for
+       * a given d.  Then return if:
+       * - If we're at the edge of the addressable part of the graph
+       * - The reverse snakes are already overlapping in the `x` coordinate
+       *
+       * then it means that the only way to get to the snake coming from the
+       * other direction is by either moving down or across for every remaining
+       * move, so record the current coord as `u` and `v` and return
+       *
+       * Note that for the backward snake we reverse xy and uv so that the
+       * matching snake is always defined in `ms` as starting at `ms.(xy)` and
+       * ending at `ms.(uv)`
+       */
+      if (odd && k >= (delta - (d - 1)) && k <= (delta + (d - 1))) {
+        if (x >= RV(k)) {
+          ms->u = x;
+          ms->v = y;
+          return 2 * d - 1;
+        }
+      }
+    }
+    /* Backwards (from bottom right) paths*/
+
+    for (k = d; k >= -d; k -= 2) {
+      int kr = (n - m) + k;
+
+      if (k == d || (k != -d && RV(kr - 1) < RV(kr + 1))) {
+        x = RV(kr - 1);
+      } else {
+        x = RV(kr + 1) - 1;
+      }
+      y = x - kr;
+
+      ms->u = x;
+      ms->v = y;
+
+      if(x > 0 && y > 0) {
+        /* matching characters, just walk up diagonal */
+        int s = DIFF_FN(_snake_rev)(
+          a + aoff + x, b + boff + y, x < y ? x : y, ctx
+        );
+        x -= s; y -= s;
+      }
+      RV(kr) = x;
+
+      /* see comments in forward section */
+      if (!odd && kr >= -d && kr <= d) {
+        if (x <= FV(kr)) {
+          ms->x = x;
+          ms->y = y;
+          return 2 * d;
+        }
+      }
+    }
+  }
+  _err(ctx, "Logic Error: failed finding middle snake, contact maintainer"); // nocov
+  return -1; // nocov
+}
+#ifdef _OPENMP
+  static void
+DIFF_FN(_ses_par)(
+  const DIFF_T *a, int aoff, int n, const DIFF_T *b, int boff, int m,
+  struct _ctx *ctx, struct middle_snake *ms, diff_op *faux_snake
+);
+#endif
+/* Generate shortest edit script
+ *
+ */
+  static int
+DIFF_FN(_ses)(
+  const DIFF_T *a, int aoff, int n, const DIFF_T *b, int boff, int m, struct _ctx *ctx
+) {
+  _interrupt(ctx);
+  struct middle_snake ms;
+  int d;
+  int fauxtop = ctx->fauxtop;  // faux snakes are freed when we're done
+
+  //Rprintf("m: %d n: %d\n", m, n);
+  if (n == 0) {
+    _edit(ctx, DIFF_INSERT, boff, m);
+    d = m;
+  } else if (m == 0) {
+    _edit(ctx, DIFF_DELETE, aoff, n);
+    d = n;
+  } else {
+    /* Find the middle "snake" around which we
+     * recursively solve the sub-problems.  Note this modifies `ms` by ref to
+     * set the beginning and end coordinates of the snake of the furthest
+     * reaching path.  The beginning is always the top left part of the snake,
+     * irrespective of whether it was found on a forward or reverse path as
+     * f_m_s will flip the coordinates when appropriately when recording them
+     * in `ms`
+     *
+     * Additionally, if diffs exceed max.diffs, then `faux.snake` will also
+     * be set.  `faux_snake` is a pointer to a pointer that points to a the
+     * beginning of an array of match/delete/insert instructions generated
+     * to connect the top left and bottom right paths. _fms() repoints the
+     * pointer to an updated edit list if needed via (_ffs())
+     */
+    diff_op fsv = DIFF_NULL;
+    diff_op * faux_snake;
+    faux_snake = &fsv;
+    //
+    // d
+    // diff_op * fsp = NULL;
+    // diff_op fsv = DIFF_NULL;
+    // *fsp = fsv;
+    // **faux_snake = *fsp;
+
+    d = DIFF_FN(_find_middle_snake)(
+      a, aoff, n, b, boff, m, ctx, &ms, &faux_snake
+    );
+    //Rprintf("d: %d\n", d);
+    if (d == -1) {
+      // nocov start
+      _err(
+        ctx, "Logic error: failed trying to find middle snake, contact maintainer."
+      );
+      // nocov end
+    } else if (ctx->ses == NULL) {
+      // nocov start
+      _err(ctx, err_msg_ubrnch, 6);
+      return d;
+      // nocov end
+    } else if (d > 1) {
+      /* in this case we have something along the lines of (note the non-
+       * diagonal bits are just non-diagonal, we're making no claims about
+       * whether they should or could be of the horizontal variety)
+       * ... -
+       *      \
+       *       \
+       *        \- ...
+       * so we will record the snake (diagonal) in the middle, and recurse
+       * on the stub at the beginning and on the stub at the end separately
+       */
+#ifdef _OPENMP
+      /* Sub-problems never need more differences than this one, so if we did
+       * not exceed `max.diffs` here neither will they.  This matters because
+       * the faux snake search relies on state left over in the V buffer, which
+       * is different when the sub-problems have their own buffers.
+       */
+      if(
+        ctx->par && !*faux_snake && ms.x + ms.y >= DIFF_PAR_MIN &&
+        n - ms.u + m - ms.v >= DIFF_PAR_MIN
+      ) {
+        DIFF_FN(_ses_par)(a, aoff, n, b, boff, m, ctx, &ms, faux_snake);
+        return d;
+      }
+#endif
+      /* Beginning stub */
+
+      if (DIFF_FN(_ses)(a, aoff, ms.x, b, boff, ms.y, ctx) == -1) {
+        // nocov start
+        _err(ctx, "Logic error: failed trying to run ses; contact maintainer.");
+        // nocov end
+      }
+      /* Now record middle snake
+       *
+       * u should be x coord of end of snake of longest path
+       * v should be y coord of end of snake
+       * x, y should be coord of begining of snake
+       *
+       * record that there is a matching section between the beginning of the
+       * middle snake and the end
+       *
+       * if faux_snake is defined it means that there were too many differences
+       * to complete algorigthm normally so we need to record the faux snake
+       */
+      if(*faux_snake) {
+        /* for faux snake length of snake will most likely not be ms.u - ms.x
+         * since it will not be a diagonal
+         */
+        _edit_faux(ctx, faux_snake, aoff + ms.x, boff + ms.y);
+      } else {
+        _edit(ctx, DIFF_MATCH, aoff + ms.x, ms.u - ms.x);
+      }
+      ctx->fauxtop = fauxtop;
+      /* Now recurse into the second stub */
+      aoff += ms.u;
+      boff += ms.v;
+      n -= ms.u;
+      m -= ms.v;
+      if (DIFF_FN(_ses)(a, aoff, n, b, boff, m, ctx) == -1) {
+        // nocov start
+        _err(ctx, "Logic error: failed trying to run ses 2; contact maintainer.");
+        // nocov end
+      }
+    } else {
+      int x = ms.x;
+      int u = ms.u;
+
+      /* There are only 4 base cases when the
+       * edit distance is 1.  Having a hard time finding cases that trigger the
+       * x == u, possibly because the algo eats leading matches, although
+       * apparently we do achieve it somewhere in the test suite.
+       *
+       * n > m   m > n
+       *
+       *   -       |
+       *    \       \    x != u
+       *     \       \
+       *
+       *   \       \
+       *    \       \    x == u
+       *     -       |
+       */
+
+      //Rprintf("x: %d u: %d y: %d v: %d\n",  ms.x, ms.u, ms.y, ms.v);
+      if (m > n) {
+        if (x == u) {
+          _edit(ctx, DIFF_MATCH, aoff, n);
+          _edit(ctx, DIFF_INSERT, boff + (m - 1), 1);
+        } else {
+          _edit(ctx, DIFF_INSERT, boff, 1);
+          _edit(ctx, DIFF_MATCH, aoff, n);
+        }
+      } else if (m < n) {
+        if (x == u) {
+          _edit(ctx, DIFF_MATCH, aoff, m);
+          _edit(ctx, DIFF_DELETE, aoff + (n - 1), 1);
+        } else {
+          _edit(ctx, DIFF_DELETE, aoff, 1);
+          _edit(ctx, DIFF_MATCH, aoff + 1, m);
+        }
+      } else {
+        // Should never get here since this should be a D 2 case
+        // nocov start
+        _err(
+          ctx, "Very special case n %d m %d aoff %d boff %d u %d\n", n, m,
+          aoff, boff, ms.u
+        );
+        // nocov end
+      }
+    }
+  }
+  ctx->fauxtop = fauxtop;
+  return d;
+}
+#ifdef _OPENMP
+/*
+ * Run `_ses` as an OpenMP task, with its own V buffer and edit script so that
+ * it is fully independent of the other tasks.  Errors are caught here and
+ * signaled to the parent task via `fail`.
+ */
+  static void
+DIFF_FN(_ses_task)(
+  const DIFF_T *a, int aoff, int n, const DIFF_T *b, int boff, int m,
+  struct _ctx *ctx, int *fail
+) {
+  jmp_buf jmp;
+  ctx->jmp = &jmp;
+  if(!setjmp(jmp)) {
+    ctx->ses = (struct diff_edit *)
+      _alloc(ctx, n + m + 1, sizeof(struct diff_edit));
+    ctx->si = 0;
+    ctx->simax = n + m;
+    ctx->buf = NULL;
+    ctx->bufcap = ctx->vmax = 0;
+    ctx->vhw = -1;
+    ctx->ws = NULL;
+    ctx->faux = NULL;
+    _buf_init(ctx, n, m);
+    DIFF_FN(_ses)(a, aoff, n, b, boff, m, ctx);
+  } else *fail = 1;
+}
+/*
+ * Parallel version of the recursive step of `_ses`: the stubs before and
+ * after the middle snake are independent so we diff them in separate tasks
+ * and then append their edit scripts in order.  The result is the same as
+ * with the sequential version.
+ */
+  static void
+DIFF_FN(_ses_par)(
+  const DIFF_T *a, int aoff, int n, const DIFF_T *b, int boff, int m,
+  struct _ctx *ctx, struct middle_snake *ms, diff_op *faux_snake
+) {
+  struct _ctx ctx1 = *ctx, ctx2 = *ctx;
+  int fail1 = 0, fail2 = 0;
+  ctx1.allocs = ctx2.allocs = NULL;
+
+  #pragma omp task shared(ctx1, fail1)
+  DIFF_FN(_ses_task)(a, aoff, ms->x, b, boff, ms->y, &ctx1, &fail1);
+  #pragma omp task shared(ctx2, fail2)
+  DIFF_FN(_ses_task)(
+    a, aoff + ms->u, n - ms->u, b, boff + ms->v, m - ms->v, &ctx2, &fail2
+  );
+  #pragma omp taskwait
+
+  if(fail1 || fail2) {
+    // nocov start
+    char errmsg[sizeof(ctx->errmsg)];
+    strcpy(errmsg, fail1 ? ctx1.errmsg : ctx2.errmsg);
+    _free_allocs(ctx1.allocs);
+    _free_allocs(ctx2.allocs);
+    _err(ctx, "%s", errmsg);
+    // nocov end
+  }
+  for(int i = 0; i < (ctx1.ses->op ? ctx1.si + 1 : 0); i++)
+    _edit(ctx, ctx1.ses[i].op, ctx1.ses[i].off, ctx1.ses[i].len);
+  if(*faux_snake) {
+    _edit_faux(ctx, faux_snake, aoff + ms->x, boff + ms->y);
+  } else {
+    _edit(ctx, DIFF_MATCH, aoff + ms->x, ms->u - ms->x);
+  }
+  for(int i = 0; i < (ctx2.ses->op ? ctx2.si + 1 : 0); i++)
+    _edit(ctx, ctx2.ses[i].op, ctx2.ses[i].off, ctx2.ses[i].len);
+
+  ctx->dmaxhit = ctx->dmaxhit || ctx1.dmaxhit || ctx2.dmaxhit;
+  _free_allocs(ctx1.allocs);
+  _free_allocs(ctx2.allocs);
+}
+#endif
+/*
+ * Entry point for `_ses` that starts the OpenMP thread team if we are to run
+ * in parallel.  The calling thread is the only one that creates tasks, and
+ * any errors are re-thrown from it after all the threads are done.
+ */
+  static int
+DIFF_FN(_ses_top)(
+  const DIFF_T *a, int aoff, int n, const DIFF_T *b, int boff, int m,
+  struct _ctx *ctx
+) {
+#ifdef _OPENMP
+  if(ctx->threads > 1 && n + m >= DIFF_PAR_MIN) {
+    jmp_buf jmp;
+    int d = -1, fail = 0, intr = 0;
+    ctx->par = 1;
+    ctx->jmp = &jmp;
+    ctx->allocs = NULL;
+    ctx->intr = &intr;
+
+    #pragma omp parallel num_threads(ctx->threads)
+    {
+      #pragma omp master
+      {
+        if(!setjmp(jmp)) d = DIFF_FN(_ses)(a, aoff, n, b, boff, m, ctx);
+        else fail = 1;
+      }
+    }
+    ctx->par = 0;
+    ctx->intr = NULL;
+    _free_allocs(ctx->allocs);
+    ctx->allocs = NULL;
+    if(fail) error("%s", ctx->errmsg);  // nocov
+    return d;
+  }
+#endif
+  return DIFF_FN(_ses)(a, aoff, n, b, boff, m, ctx);
+}
+/*
+ * Eat the common leading and trailing elements, discard elements without a
+ * counterpart, and compute the SES on what remains.
+ *
+ * The _ses function assumes the SES will begin or end with a delete
+ * or insert. The following will ensure this is true by eating any
+ * beginning matches. This is also a quick to process sequences
+ * that match entirely.
+ *
+ * For large problems we also eat the trailing matches and discard elements
+ * without counterparts as they would otherwise needlessly increase the size
+ * of the search.  This is not done for small problems as it does not pay for
+ * itself there, and because it may change which of several equally short
+ * edit scripts is found (all of them are still shortest).
+ */
+  static int
+DIFF_FN(_diff)(
+  const DIFF_T *a, int aoff, int n, const DIFF_T *b, int boff, int m,
+  struct _ctx *ctx
+) {
+  int x = 0, s = 0, d;
+
+  x = DIFF_FN(_snake_fwd)(a + aoff, b + boff, n < m ? n : m, ctx);
+  _edit(ctx, DIFF_MATCH, aoff, x);
+  aoff += x;
+  boff += x;
+  n -= x;
+  m -= x;
+
+  if(n + m >= DIFF_PREP_MIN) {
+    s = DIFF_FN(_snake_rev)(a + aoff + n, b + boff + m, n < m ? n : m, ctx);
+    n -= s;
+    m -= s;
+    d = _discard(ctx, aoff, n, boff, m);
+  } else d = -1;
+
+  if(d < 0) {
+    _buf_init(ctx, n, m);
+    d = DIFF_FN(_ses_top)(a, aoff, n, b, boff, m, ctx);
+  }
+  _edit(ctx, DIFF_MATCH, aoff + n, s);
+  return d;
+}
+
+#undef DIFF_T
+#undef DIFF_EQ
+#undef DIFF_FN
@@ -17,9 +17,78 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "diffobj.h"
 
-SEXP DIFFOBJ_diffobj(SEXP a, SEXP b, SEXP max) {
+// Minimum total number of elements across all pairs for `diffobj_batch` to
+// use threads
+
+#ifndef DIFF_BATCH_PAR_MIN
+#define DIFF_BATCH_PAR_MIN 10000
+#endif
+
+/*
+ * Map edit ops to the codes used on the R side, see `.edit.map`
+ */
+static int edit_code(short op) {
+  switch (op) {
+    case DIFF_MATCH: return 1;
+    case DIFF_INSERT: return 2;
+    case DIFF_DELETE: return 3;
+  }
+  error("Logic Error: unexpected edit op; contact maintainer."); // nocov
+  return 0; // nocov
+}
+
+/*
+ * Workspaces hold memory that can be reused across diffs, see `diff_ws`.  On
+ * the R side they are external pointers that free the memory when collected.
+ */
+static void ws_finalize(SEXP x) {
+  struct diff_ws *ws = (struct diff_ws *) R_ExternalPtrAddr(x);
+  if(ws) {
+    diff_ws_free(ws);
+    free(ws);
+    R_ClearExternalPtr(x);
+  }
+}
+static SEXP ws_new(void) {
+  struct diff_ws *ws = (struct diff_ws *) calloc(1, sizeof(struct diff_ws));
+  if(!ws) error("Unable to allocate diff workspace.");  // nocov
+  SEXP res = PROTECT(
+    R_MakeExternalPtr(ws, install("diffobj_workspace"), R_NilValue)
+  );
+  R_RegisterCFinalizerEx(res, ws_finalize, TRUE);
+  UNPROTECT(1);
+  return res;
+}
+static struct diff_ws *ws_get(SEXP x) {
+  if(x == R_NilValue) return NULL;
+  if(
+    TYPEOF(x) != EXTPTRSXP || R_ExternalPtrTag(x) != install("diffobj_workspace")
+  )
+    error("Logic Error: `ws` not a diff workspace"); // nocov
+  struct diff_ws *ws = (struct diff_ws *) R_ExternalPtrAddr(x);
+  if(!ws)
+    error(
+      "Argument `workspace` is no longer valid, possibly because it was "
+      "serialized; create a new one with `diff_workspace()`."
+    );
+  return ws;
+}
+SEXP DIFFOBJ_workspace(void) {
+  return ws_new();
+}
+SEXP DIFFOBJ_diffobj(
+  SEXP a, SEXP b, SEXP max, SEXP tol, SEXP algo, SEXP threads, SEXP ws
+) {
   int n, m, d;
   int sn, i;
   /* allocate max possible size for edit script; wasteful, but this greatly
@@ -36,10 +105,48 @@ SEXP DIFFOBJ_diffobj(SEXP a, SEXP b, SEXP max) {
   int max_i = asInteger(max);
   if(max_i < 0) max_i = 0;
 
-  struct diff_edit *ses = (struct diff_edit *)
-    R_alloc(n + m + 1, sizeof(struct diff_edit));
+  if(TYPEOF(a) != TYPEOF(b))
+    error("Logic Error: `a` and `b` must be the same type"); // nocov
+  SEXPTYPE type_a = TYPEOF(a);
+  if(
+    type_a != STRSXP && type_a != INTSXP && type_a != REALSXP &&
+    type_a != RAWSXP
+  )
+    // nocov start
+    error(
+      "Logic Error: `a` and `b` must be character, integer, double, or raw"
+    );
+    // nocov end
+  if(TYPEOF(tol) != REALSXP || XLENGTH(tol) != 2)
+    error("Logic Error: `tol` not numeric(2L)"); // nocov
 
-  d = diff(a, 0, n, b, 0, m, NULL, max_i, ses, &sn);
+  if(
+    TYPEOF(algo) != INTSXP || XLENGTH(algo) != 1L ||
+    asInteger(algo) < DIFF_ALGO_MYERS || asInteger(algo) > DIFF_ALGO_BITPAR
+  )
+    error("Logic Error: `algo` not a valid algorithm code"); // nocov
+  if(
+    TYPEOF(threads) != INTSXP || XLENGTH(threads) != 1L ||
+    asInteger(threads) == NA_INTEGER || asInteger(threads) < 1
+  )
+    error("Logic Error: `threads` not positive integer(1L)"); // nocov
+
+  struct diff_opts opts = {
+    .tol_abs=REAL(tol)[0], .tol_rel=REAL(tol)[1], .algo=asInteger(algo),
+    .threads=asInteger(threads), .ws=ws_get(ws)
+  };
+  if(!(opts.tol_abs >= 0) || !(opts.tol_rel >= 0))
+    error("Logic Error: `tol` must be non-negative and not NA"); // nocov
+
+  struct diff_edit *ses;
+  if(opts.ws) {
+    ses = diff_ws_ses(opts.ws, n + m + 1);
+    if(!ses) error("Unable to allocate memory for diff.");  // nocov
+  } else {
+    ses = (struct diff_edit *) R_alloc(n + m + 1, sizeof(struct diff_edit));
+  }
+
+  d = diff(a, 0, n, b, 0, m, &opts, max_i, ses, &sn);
 
   SEXP res = PROTECT(allocVector(VECSXP, 4));
   SEXP type = PROTECT(allocVector(INTSXP, sn));
@@ -49,17 +156,7 @@ SEXP DIFFOBJ_diffobj(SEXP a, SEXP b, SEXP max) {
   for (i = 0; i < sn; i++) {
     struct diff_edit *e = ses + i;
 
-    switch (e->op) {
-      case DIFF_MATCH:
-        INTEGER(type)[i] = 1;
-        break;
-      case DIFF_INSERT:
-        INTEGER(type)[i] = 2;
-        break;
-      case DIFF_DELETE:
-        INTEGER(type)[i] = 3;
-        break;
-    }
+    INTEGER(type)[i] = edit_code(e->op);
     INTEGER(count)[i] = e->len;
     INTEGER(offs)[i] = e->off;
   }
@@ -72,3 +169,217 @@ SEXP DIFFOBJ_diffobj(SEXP a, SEXP b, SEXP max) {
   return res;
 }
 
+/*
+ * Monotonic time in seconds, for benchmarks only
+ */
+static double bench_now(void) {
+#ifdef _WIN32
+  LARGE_INTEGER freq, t;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&t);
+  return (double) t.QuadPart / (double) freq.QuadPart;
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double) t.tv_sec + (double) t.tv_nsec * 1e-9;
+#endif
+}
+/*
+ * Time `reps` runs of `diff` on character vectors `a` and `b`
+ *
+ * This is the micro-benchmark driver for the suite in `bench/`, so that the
+ * engine can be timed without the costs of converting the edit script to R
+ * objects.  All runs share a workspace as repeated diffs in the package do,
+ * and memory `diff` allocates with `R_alloc` is released after each run.
+ *
+ * Returns the elapsed seconds of each run, with the edit distance as the
+ * "diffs" attribute.
+ */
+SEXP DIFFOBJ_diffobj_bench(
+  SEXP a, SEXP b, SEXP max, SEXP algo, SEXP reps
+) {
+  if(TYPEOF(a) != STRSXP || TYPEOF(b) != STRSXP)
+    error("Logic Error: `a` and `b` must be character"); // nocov
+  if(
+    TYPEOF(max) != INTSXP || XLENGTH(max) != 1L || asInteger(max) == NA_INTEGER
+  )
+    error("Logic Error: `max` not integer(1L) and not NA"); // nocov
+  if(
+    TYPEOF(algo) != INTSXP || XLENGTH(algo) != 1L ||
+    asInteger(algo) < DIFF_ALGO_MYERS || asInteger(algo) > DIFF_ALGO_BITPAR
+  )
+    error("Logic Error: `algo` not a valid algorithm code"); // nocov
+  if(
+    TYPEOF(reps) != INTSXP || XLENGTH(reps) != 1L ||
+    asInteger(reps) == NA_INTEGER || asInteger(reps) < 1
+  )
+    error("Logic Error: `reps` not positive integer(1L)"); // nocov
+
+  int n = XLENGTH(a), m = XLENGTH(b), sn, d = 0;
+  int max_i = asInteger(max), reps_i = asInteger(reps);
+  if(max_i < 0) max_i = 0;
+
+  SEXP ws = PROTECT(ws_new());
+  struct diff_opts opts = {
+    .algo=asInteger(algo), .threads=1, .ws=ws_get(ws)
+  };
+  struct diff_edit *ses = diff_ws_ses(opts.ws, n + m + 1);
+  if(!ses) error("Unable to allocate memory for diff.");  // nocov
+
+  SEXP res = PROTECT(allocVector(REALSXP, reps_i));
+  for(int i = 0; i < reps_i; ++i) {
+    const void *vmax = vmaxget();
+    double start = bench_now();
+    d = diff(a, 0, n, b, 0, m, &opts, max_i, ses, &sn);
+    REAL(res)[i] = bench_now() - start;
+    vmaxset(vmax);
+  }
+  setAttrib(res, install("diffs"), ScalarInteger(d));
+  UNPROTECT(2);
+  return res;
+}
+/*
+ * Diff each pair of character vectors in the lists `a` and `b` with algorithm
+ * `algo`, optionally using several threads across the pairs.  As only the
+ * deleted and inserted elements are used `algo` may be DIFF_ALGO_AUTO.
+ *
+ * This avoids the per call overhead of `DIFFOBJ_diffobj` when there are many
+ * small diffs to compute, as with the in-hunk word diffs, including that of
+ * allocating and clearing memory for each diff.  The edit scripts
+ * are returned concatenated, with a `pair` vector recording which pair each
+ * edit belongs to, followed by the edit distance of each pair.
+ */
+SEXP DIFFOBJ_diffobj_batch(SEXP a, SEXP b, SEXP max, SEXP algo, SEXP threads) {
+  if(TYPEOF(a) != VECSXP || TYPEOF(b) != VECSXP || XLENGTH(a) != XLENGTH(b))
+    error("Logic Error: `a` and `b` must be lists of same length"); // nocov
+  if(
+    TYPEOF(max) != INTSXP || XLENGTH(max) != 1L || asInteger(max) == NA_INTEGER
+  )
+    error("Logic Error: `max` not integer(1L) and not NA"); // nocov
+  if(
+    TYPEOF(algo) != INTSXP || XLENGTH(algo) != 1L ||
+    asInteger(algo) < DIFF_ALGO_MYERS || asInteger(algo) > DIFF_ALGO_AUTO
+  )
+    error("Logic Error: `algo` not a valid algorithm code"); // nocov
+  if(
+    TYPEOF(threads) != INTSXP || XLENGTH(threads) != 1L ||
+    asInteger(threads) == NA_INTEGER || asInteger(threads) < 1
+  )
+    error("Logic Error: `threads` not positive integer(1L)"); // nocov
+
+  int max_i = asInteger(max);
+  diff_algo algo_i = asInteger(algo);
+  if(max_i < 0) max_i = 0;
+  int np = XLENGTH(a);
+
+  // Each pair gets its own slice of one large edit script buffer
+
+  size_t *sesoff = (size_t *) R_alloc(np + 1, sizeof(size_t));
+  int *ds = (int *) R_alloc(np, sizeof(int));
+  int *sns = (int *) R_alloc(np, sizeof(int));
+  sesoff[0] = 0;
+  for(int i = 0; i < np; i++) {
+    SEXP ai = VECTOR_ELT(a, i), bi = VECTOR_ELT(b, i);
+    if(TYPEOF(ai) != STRSXP || TYPEOF(bi) != STRSXP)
+      error("Logic Error: `a` and `b` must contain character vectors"); // nocov
+    sesoff[i + 1] = sesoff[i] + XLENGTH(ai) + XLENGTH(bi) + 1;
+  }
+  struct diff_edit *ses = (struct diff_edit *)
+    R_alloc(sesoff[np], sizeof(struct diff_edit));
+
+  int par = 0;
+#ifdef _OPENMP
+  int nthreads = asInteger(threads);
+  par = nthreads > 1 && np > 1 && sesoff[np] - np >= DIFF_BATCH_PAR_MIN;
+#endif
+  // All diffs done by a thread share a workspace
+
+  if(!par) {
+    SEXP ws = PROTECT(ws_new());
+    struct diff_opts opts = {.algo=algo_i, .threads=1, .ws=ws_get(ws)};
+    for(int i = 0; i < np; i++) {
+      SEXP ai = VECTOR_ELT(a, i), bi = VECTOR_ELT(b, i);
+      ds[i] = diff(
+        ai, 0, XLENGTH(ai), bi, 0, XLENGTH(bi), &opts, max_i,
+        ses + sesoff[i], sns + i
+      );
+    }
+    UNPROTECT(1);
+  } else {
+#ifdef _OPENMP
+    // Only the main thread may touch the R API, so we collect the pointers to
+    // the SEXPs up front; `diff` in worker mode only reads the vector data
+
+    SEXP *as = (SEXP *) R_alloc(np, sizeof(SEXP));
+    SEXP *bs = (SEXP *) R_alloc(np, sizeof(SEXP));
+    for(int i = 0; i < np; i++) {
+      as[i] = VECTOR_ELT(a, i);
+      bs[i] = VECTOR_ELT(b, i);
+      // force any deferred data into memory while we're on the main thread
+      (void) STRING_PTR_RO(as[i]);
+      (void) STRING_PTR_RO(bs[i]);
+    }
+    int fail = -1, intr = 0;
+    char errmsg[256];
+    struct diff_ws *wss = (struct diff_ws *)
+      R_alloc(nthreads, sizeof(struct diff_ws));
+    memset(wss, 0, nthreads * sizeof(struct diff_ws));
+
+    #pragma omp parallel num_threads(nthreads)
+    {
+      struct diff_opts opts = {
+        .algo=algo_i, .threads=1, .worker=1, .intr=&intr,
+        .ws=wss + omp_get_thread_num()
+      };
+
+      #pragma omp for schedule(dynamic)
+      for(int i = 0; i < np; i++) {
+        ds[i] = diff(
+          as[i], 0, XLENGTH(as[i]), bs[i], 0, XLENGTH(bs[i]), &opts, max_i,
+          ses + sesoff[i], sns + i
+        );
+        if(ds[i] == INT_MIN) {
+          #pragma omp critical
+          if(fail < 0) {
+            fail = i;
+            memcpy(errmsg, opts.errmsg, sizeof(errmsg));
+          }
+        }
+      }
+    }
+    for(int i = 0; i < nthreads; i++) diff_ws_free(wss + i);
+    if(fail >= 0) error("%s", errmsg);  // nocov
+#endif
+  }
+  // Concatenate the edit scripts
+
+  R_xlen_t sn = 0;
+  for(int i = 0; i < np; i++) sn += sns[i];
+
+  SEXP res = PROTECT(allocVector(VECSXP, 5));
+  SEXP pair = PROTECT(allocVector(INTSXP, sn));
+  SEXP type = PROTECT(allocVector(INTSXP, sn));
+  SEXP count = PROTECT(allocVector(INTSXP, sn));
+  SEXP offs = PROTECT(allocVector(INTSXP, sn));
+  SEXP diffs = PROTECT(allocVector(INTSXP, np));
+
+  R_xlen_t k = 0;
+  for(int i = 0; i < np; i++) {
+    for(int j = 0; j < sns[i]; j++, k++) {
+      struct diff_edit *e = ses + sesoff[i] + j;
+      INTEGER(pair)[k] = i + 1;
+      INTEGER(type)[k] = edit_code(e->op);
+      INTEGER(count)[k] = e->len;
+      INTEGER(offs)[k] = e->off;
+    }
+    INTEGER(diffs)[i] = ds[i];
+  }
+  SET_VECTOR_ELT(res, 0, pair);
+  SET_VECTOR_ELT(res, 1, type);
+  SET_VECTOR_ELT(res, 2, count);
+  SET_VECTOR_ELT(res, 3, offs);
+  SET_VECTOR_ELT(res, 4, diffs);
+  UNPROTECT(6);
+
+  return res;
+}
@@ -23,7 +23,33 @@
 #include <Rinternals.h>
 #include "diff.h"
 
-SEXP DIFFOBJ_diffobj(SEXP a, SEXP b, SEXP max);
+SEXP DIFFOBJ_diffobj(
+  SEXP a, SEXP b, SEXP max, SEXP tol, SEXP algo, SEXP threads, SEXP ws
+);
+SEXP DIFFOBJ_workspace(void);
+SEXP DIFFOBJ_diffobj_batch(SEXP a, SEXP b, SEXP max, SEXP algo, SEXP threads);
+SEXP DIFFOBJ_diffobj_bench(SEXP a, SEXP b, SEXP max, SEXP algo, SEXP reps);
+SEXP DIFFOBJ_words(SEXP chr, SEXP match_quotes);
+SEXP DIFFOBJ_file_read(SEXP path);
+SEXP DIFFOBJ_file_ids(SEXP a, SEXP b, SEXP norm);
+SEXP DIFFOBJ_file_lines(SEXP x, SEXP ind);
+SEXP DIFFOBJ_file_close(SEXP x);
+SEXP DIFFOBJ_hunks(SEXP type, SEXP len, SEXP off);
+SEXP DIFFOBJ_hunks_group(SEXP ctx, SEXP len, SEXP context);
+SEXP DIFFOBJ_align(
+  SEXP a, SEXP b, SEXP a_tok, SEXP b_tok, SEXP min_chars, SEXP threshold,
+  SEXP alnum
+);
+SEXP DIFFOBJ_strip_hz(SEXP txt, SEXP stops);
+SEXP DIFFOBJ_nchar(SEXP x, SEXP type);
+SEXP DIFFOBJ_wrap(SEXP x, SEXP width);
+SEXP DIFFOBJ_hash_tree(SEXP x);
+SEXP DIFFOBJ_dat_new(SEXP x);
+SEXP DIFFOBJ_dat_get(SEXP x, SEXP col, SEXP ind);
+SEXP DIFFOBJ_dat_set(SEXP x, SEXP col, SEXP ind, SEXP value);
+SEXP DIFFOBJ_dat_rows(SEXP x, SEXP ind);
+SEXP DIFFOBJ_dat_splice(SEXP x, SEXP lo, SEXP hi, SEXP value);
+SEXP DIFFOBJ_dat_list(SEXP x);
 
 #endif
 
@@ -0,0 +1,370 @@
+/*
+ * Copyright (C) 2018  Brodie Gaslam
+ *
+ * This file is part of "diffobj - Diffs for R Objects"
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "diffobj.h"
+
+/*
+ * Files for `diffFile`
+ *
+ * Files are mapped into memory (read in whole on Windows) and split into lines
+ * the way `readLines` does, but without creating R strings.  The lines are
+ * then reduced to integer ids that are equal for equal lines so they can be
+ * diffed as integer vectors, and only the lines that end up being displayed
+ * are turned into R strings.
+ *
+ * Only plain ASCII files are handled here; anything that might be treated
+ * differently by `readLines` or by the subsequent processing of the lines
+ * (non-ASCII, NULs, ANSI escapes, compressed files, atomic vector row
+ * headers) is left to the R level code.
+ */
+
+struct diff_file {
+  char *dat;        /* file contents */
+  size_t size;
+  int mapped;       /* whether `dat` is mapped or allocated */
+  int n;            /* number of lines */
+  int cap;
+  size_t *start;    /* offset of each line in `dat` */
+  int *len;         /* length of each line excluding the EOL marker */
+};
+
+static void file_free(struct diff_file *f) {
+  if(f->dat) {
+#ifndef _WIN32
+    if(f->mapped) munmap(f->dat, f->size); else free(f->dat);
+#else
+    free(f->dat);
+#endif
+  }
+  free(f->start);
+  free(f->len);
+  memset(f, 0, sizeof(struct diff_file));
+}
+static void file_finalize(SEXP x) {
+  struct diff_file *f = (struct diff_file *) R_ExternalPtrAddr(x);
+  if(f) {
+    file_free(f);
+    free(f);
+    R_ClearExternalPtr(x);
+  }
+}
+static struct diff_file *file_get(SEXP x) {
+  if(
+    TYPEOF(x) != EXTPTRSXP || R_ExternalPtrTag(x) != install("diffobj_file")
+  )
+    error("Logic Error: not a diffobj file; contact maintainer."); // nocov
+  struct diff_file *f = (struct diff_file *) R_ExternalPtrAddr(x);
+  if(!f)
+    // nocov start
+    error("Logic Error: diffobj file already closed; contact maintainer.");
+    // nocov end
+  return f;
+}
+/*
+ * Load the contents of `path` into `f`, return 0 if the file could not be read
+ * in which case we let `readLines` try and report the error.
+ */
+static int file_load(struct diff_file *f, const char *path) {
+#ifndef _WIN32
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) return 0;
+  struct stat st;
+  if(fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return 0;
+  }
+  f->size = (size_t) st.st_size;
+  if(f->size) {
+    void *dat = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(dat == MAP_FAILED) {
+      close(fd);
+      return 0;
+    }
+    f->dat = (char *) dat;
+    f->mapped = 1;
+  }
+  close(fd);
+  return 1;
+#else
+  FILE *fp = fopen(path, "rb");
+  if(!fp) return 0;
+  if(_fseeki64(fp, 0, SEEK_END)) {
+    fclose(fp);
+    return 0;
+  }
+  long long size = _ftelli64(fp);
+  if(size < 0 || _fseeki64(fp, 0, SEEK_SET)) {
+    fclose(fp);
+    return 0;
+  }
+  f->size = (size_t) size;
+  if(f->size) {
+    f->dat = (char *) malloc(f->size);
+    if(!f->dat || fread(f->dat, 1, f->size, fp) != f->size) {
+      fclose(fp);
+      return 0;
+    }
+  }
+  fclose(fp);
+  return 1;
+#endif
+}
+static int file_add_line(struct diff_file *f, size_t start, size_t len) {
+  if(len > INT_MAX || f->n == INT_MAX) return 0;
+  if(f->n == f->cap) {
+    int cap = f->cap ? (f->cap > INT_MAX / 2 ? INT_MAX : f->cap * 2) : 1024;
+    size_t *s = (size_t *) realloc(f->start, cap * sizeof(size_t));
+    if(s) f->start = s;
+    int *l = (int *) realloc(f->len, cap * sizeof(int));
+    if(l) f->len = l;
+    if(!s || !l) error("Unable to allocate memory to read file.");  // nocov
+    f->cap = cap;
+  }
+  f->start[f->n] = start;
+  f->len[f->n++] = (int) len;
+  return 1;
+}
+/*
+ * Map a file and split it into lines; returns NULL if the file should be read
+ * with `readLines` instead, or a list with the file, the number of lines, the
+ * width of the widest line, and whether the last line is incomplete, there are
+ * any tabs, or any characters that are special in HTML.
+ */
+SEXP DIFFOBJ_file_read(SEXP path) {
+  if(TYPEOF(path) != STRSXP || XLENGTH(path) != 1)
+    error("Logic Error: `path` must be character(1L)"); // nocov
+
+  struct diff_file *f =
+    (struct diff_file *) calloc(1, sizeof(struct diff_file));
+  if(!f) error("Unable to allocate memory to read file.");  // nocov
+  SEXP ptr =
+    PROTECT(R_MakeExternalPtr(f, install("diffobj_file"), R_NilValue));
+  R_RegisterCFinalizerEx(ptr, file_finalize, TRUE);
+
+  if(!file_load(f, translateChar(STRING_ELT(path, 0)))) {
+    UNPROTECT(1);
+    return R_NilValue;
+  }
+  const unsigned char *dat = (const unsigned char *) f->dat;
+  size_t size = f->size, i = 0, j, width = 0;
+  int incomplete = 0, tab = 0, html = 0;
+
+  // `file` would decompress bzip2 files (other formats are not ASCII)
+
+  int ok = !(size >= 3 && dat[0] == 'B' && dat[1] == 'Z' && dat[2] == 'h');
+
+  while(ok && i < size) {
+    for(j = i; j < size && dat[j] != '\n' && dat[j] != '\r'; ++j) {
+      unsigned char c = dat[j];
+      if(c > 127 || !c || c == 27) {
+        ok = 0;
+        break;
+      }
+      tab |= c == '\t';
+      html |= c == '<' || c == '&';
+    }
+    if(!ok) break;
+
+    // Lines that could be mistaken for atomic vector row headers
+
+    size_t k;
+    for(k = i; k < j && (dat[k] == ' ' || dat[k] == '\t' ||
+      dat[k] == '\v' || dat[k] == '\f'); ++k);
+    if(k + 1 < j && dat[k] == '[' && dat[k + 1] >= '1' && dat[k + 1] <= '9') {
+      ok = 0;
+      break;
+    }
+    if(!(ok = file_add_line(f, i, j - i))) break;
+    if(j - i > width) width = j - i;
+
+    // Like `readLines` accept LF, CRLF, and CR as EOL markers
+
+    if(j == size) incomplete = 1;
+    else if(dat[j] == '\r' && j + 1 < size && dat[j + 1] == '\n') ++j;
+    i = j + 1;
+  }
+  if(!ok) {
+    file_free(f);
+    UNPROTECT(1);
+    return R_NilValue;
+  }
+  SEXP res = PROTECT(allocVector(VECSXP, 6));
+  SET_VECTOR_ELT(res, 0, ptr);
+  SET_VECTOR_ELT(res, 1, ScalarInteger(f->n));
+  SET_VECTOR_ELT(res, 2, ScalarInteger((int) width));
+  SET_VECTOR_ELT(res, 3, ScalarLogical(incomplete));
+  SET_VECTOR_ELT(res, 4, ScalarLogical(tab));
+  SET_VECTOR_ELT(res, 5, ScalarLogical(html));
+  UNPROTECT(2);
+  return res;
+}
+/*
+ * Release the file memory without waiting for garbage collection; closing a
+ * file more than once is fine
+ */
+SEXP DIFFOBJ_file_close(SEXP x) {
+  if(
+    TYPEOF(x) != EXTPTRSXP || R_ExternalPtrTag(x) != install("diffobj_file")
+  )
+    error("Logic Error: not a diffobj file; contact maintainer."); // nocov
+  file_finalize(x);
+  return R_NilValue;
+}
+/*
+ * Line comparison keys; with `norm` the keys are the lines as modified by
+ * `normalize_whitespace`: leading and trailing whitespace removed, and runs of
+ * spaces and tabs replaced by one space.
+ */
+static int key_blank(char c) {
+  return c == ' ' || c == '\t';
+}
+static void key_bounds(
+  const char *s, int len, int norm, const char **from, const char **to
+) {
+  *from = s;
+  *to = s + len;
+  if(norm) {
+    // `trimws` also removes CR and LF, but those never appear in lines
+    while(*from < *to && key_blank(**from)) ++*from;
+    while(*to > *from && key_blank(*(*to - 1))) --*to;
+  }
+}
+static uint64_t key_hash(const char *s, int len, int norm) {
+  const char *p, *e;
+  uint64_t h = 14695981039346656037ULL;  // FNV-1a
+  key_bounds(s, len, norm, &p, &e);
+  while(p < e) {
+    char c = *p++;
+    if(norm && key_blank(c)) {
+      while(p < e && key_blank(*p)) ++p;
+      c = ' ';
+    }
+    h = (h ^ (unsigned char) c) * 1099511628211ULL;
+  }
+  return h;
+}
+static int key_eq(
+  const char *s1, int len1, const char *s2, int len2, int norm
+) {
+  const char *p1, *e1, *p2, *e2;
+  if(!norm) return len1 == len2 && !memcmp(s1, s2, len1);
+  key_bounds(s1, len1, norm, &p1, &e1);
+  key_bounds(s2, len2, norm, &p2, &e2);
+  while(p1 < e1 && p2 < e2) {
+    char c1 = *p1++, c2 = *p2++;
+    if(key_blank(c1)) {
+      while(p1 < e1 && key_blank(*p1)) ++p1;
+      c1 = ' ';
+    }
+    if(key_blank(c2)) {
+      while(p2 < e2 && key_blank(*p2)) ++p2;
+      c2 = ' ';
+    }
+    if(c1 != c2) return 0;
+  }
+  return p1 == e1 && p2 == e2;
+}
+/*
+ * Assign ids to the lines of both files such that lines have the same id if
+ * and only if their keys are equal.  Returns a list with the ids for each file.
+ */
+SEXP DIFFOBJ_file_ids(SEXP a, SEXP b, SEXP norm) {
+  if(TYPEOF(norm) != LGLSXP || XLENGTH(norm) != 1)
+    error("Logic Error: `norm` must be TRUE or FALSE"); // nocov
+  struct diff_file *fs[2] = {file_get(a), file_get(b)};
+  int norm_i = asLogical(norm) == 1;
+  R_xlen_t tot = (R_xlen_t) fs[0]->n + fs[1]->n;
+
+  // Open addressing hash table of ids at least twice as big as the lines, ids
+  // record the hash and one line with that key
+
+  size_t tsize = 16;
+  while(tsize < 2 * (size_t) tot) tsize *= 2;
+  int *tab = (int *) R_alloc(tsize, sizeof(int));
+  memset(tab, 0, tsize * sizeof(int));
+  uint64_t *ihash = (uint64_t *) R_alloc(tot + 1, sizeof(uint64_t));
+  R_xlen_t *iline = (R_xlen_t *) R_alloc(tot + 1, sizeof(R_xlen_t));
+  int nid = 0;
+
+  SEXP res = PROTECT(allocVector(VECSXP, 2));
+  for(int k = 0; k < 2; ++k) {
+    struct diff_file *f = fs[k];
+    SEXP ids = PROTECT(allocVector(INTSXP, f->n));
+    int *idsi = INTEGER(ids);
+    for(int i = 0; i < f->n; ++i) {
+      const char *s = f->dat + f->start[i];
+      int len = f->len[i];
+      uint64_t h = key_hash(s, len, norm_i);
+      size_t slot = (size_t) h & (tsize - 1);
+      int id;
+      while((id = tab[slot])) {
+        if(ihash[id] == h) {
+          R_xlen_t l = iline[id];
+          struct diff_file *fl = l < fs[0]->n ? fs[0] : fs[1];
+          int li = (int) (l < fs[0]->n ? l : l - fs[0]->n);
+          if(key_eq(s, len, fl->dat + fl->start[li], fl->len[li], norm_i))
+            break;
+        }
+        slot = (slot + 1) & (tsize - 1);
+      }
+      if(!id) {
+        id = tab[slot] = ++nid;
+        ihash[id] = h;
+        iline[id] = (k ? fs[0]->n : 0) + i;
+      }
+      idsi[i] = id;
+    }
+    SET_VECTOR_ELT(res, k, ids);
+    UNPROTECT(1);
+  }
+  UNPROTECT(1);
+  return res;
+}
+/*
+ * Turn the lines at 1-based indices `ind` into R strings
+ */
+SEXP DIFFOBJ_file_lines(SEXP x, SEXP ind) {
+  struct diff_file *f = file_get(x);
+  if(TYPEOF(ind) != INTSXP)
+    error("Logic Error: `ind` must be integer"); // nocov
+  R_xlen_t len = XLENGTH(ind);
+  SEXP res = PROTECT(allocVector(STRSXP, len));
+  for(R_xlen_t i = 0; i < len; ++i) {
+    int k = INTEGER(ind)[i];
+    if(k == NA_INTEGER || k < 1 || k > f->n)
+      // nocov start
+      error("Logic Error: line index out of bounds; contact maintainer.");
+      // nocov end
+    SET_STRING_ELT(
+      res, i, mkCharLenCE(f->dat + f->start[k - 1], f->len[k - 1], CE_NATIVE)
+    );
+  }
+  UNPROTECT(1);
+  return res;
+}
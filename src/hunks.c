@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2018  Brodie Gaslam
+ *
+ * This file is part of "diffobj - Diffs for R Objects"
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
+ */
+
+#include <limits.h>
+#include "diffobj.h"
+
+/*
+ * Hunk construction
+ *
+ * These compute the tables that `as.hunks` and `process_hunks` turn into the
+ * lists of hunks used by the rest of the package, so that the only work left
+ * in R is one pass over the hunks to build them.
+ */
+
+/*
+ * Split the edit script into atomic hunks, where each match is a hunk, and
+ * each run of consecutive inserts and deletes is a hunk.
+ *
+ * `type` are the codes of the edit types (1 Match, 2 Insert, 3 Delete, as in
+ * `.edit.map`), and `len` and `off` the lengths and 1-based offsets of each
+ * edit.
+ *
+ * Returns a list with whether each hunk is a context hunk, and the 0-based
+ * positions each hunk starts after in `target` and `current`, along with how
+ * many elements of each it spans.
+ */
+SEXP DIFFOBJ_hunks(SEXP type, SEXP len, SEXP off) {
+  if(
+    TYPEOF(type) != INTSXP || TYPEOF(len) != INTSXP || TYPEOF(off) != INTSXP ||
+    XLENGTH(type) != XLENGTH(len) || XLENGTH(type) != XLENGTH(off)
+  )
+    error("Logic Error: bad edit script data; contact maintainer."); // nocov
+
+  R_xlen_t n = XLENGTH(type), i, k;
+  const int *t = INTEGER(type), *l = INTEGER(len), *o = INTEGER(off);
+
+  // Every match is its own hunk, and the only other breaks are between
+  // non-matching edits and matches, so count the hunks first
+
+  R_xlen_t hn = 0;
+  for(i = 0; i < n; ++i) {
+    if(t[i] < 1 || t[i] > 3)
+      error("Logic Error: unknown edit type; contact maintainer."); // nocov
+    if(t[i] == 1 || !i || t[i - 1] == 1) ++hn;
+  }
+  SEXP res = PROTECT(allocVector(VECSXP, 5));
+  SEXP ctx = PROTECT(allocVector(LGLSXP, hn));
+  SEXP tar_start = PROTECT(allocVector(INTSXP, hn));
+  SEXP tar_len = PROTECT(allocVector(INTSXP, hn));
+  SEXP cur_start = PROTECT(allocVector(INTSXP, hn));
+  SEXP cur_len = PROTECT(allocVector(INTSXP, hn));
+
+  // `last_a` is the furthest position in `target` reached so far, and `last_b`
+  // the same for `current`
+
+  int last_a = 0, last_b = 0;
+  for(i = 0, k = -1; i < n; ++i) {
+    if(t[i] == 1 || !i || t[i - 1] == 1) {
+      ++k;
+      LOGICAL(ctx)[k] = t[i] == 1;
+      INTEGER(tar_start)[k] = last_a;
+      INTEGER(cur_start)[k] = last_b;
+      INTEGER(tar_len)[k] = INTEGER(cur_len)[k] = 0;
+    }
+    if(t[i] != 2) {
+      INTEGER(tar_len)[k] += l[i];
+      if(o[i] + l[i] - 1 > last_a) last_a = o[i] + l[i] - 1;
+    }
+    if(t[i] != 3) {
+      INTEGER(cur_len)[k] += l[i];
+      last_b += l[i];
+    }
+  }
+  for(k = 0; k < hn; ++k) {
+    if(!INTEGER(tar_len)[k] && !INTEGER(cur_len)[k])
+      error("Logic Error: unexpected edit types; contact maintainer."); // nocov
+  }
+  SET_VECTOR_ELT(res, 0, ctx);
+  SET_VECTOR_ELT(res, 1, tar_start);
+  SET_VECTOR_ELT(res, 2, tar_len);
+  SET_VECTOR_ELT(res, 3, cur_start);
+  SET_VECTOR_ELT(res, 4, cur_len);
+  UNPROTECT(6);
+  return res;
+}
+/*
+ * Group atomic hunks into hunk groups
+ *
+ * Each difference hunk is shown with up to `context` lines of the context
+ * hunks on either side, and if a context hunk is no longer than twice that the
+ * hunks on either side of it end up in the same group.
+ *
+ * `ctx` are whether each atomic hunk is a context hunk, which must alternate,
+ * and `len` the number of lines in each.
+ *
+ * Returns a list with the 1-based hunk group and atomic hunk ids of each
+ * element of the groups, and whether the element is the whole atomic hunk
+ * (0), or its head (1) or tail (2) only.  Context hunks between groups are
+ * used twice, as the tail of one and head of the other.
+ */
+SEXP DIFFOBJ_hunks_group(SEXP ctx, SEXP len, SEXP context) {
+  if(
+    TYPEOF(ctx) != LGLSXP || TYPEOF(len) != INTSXP ||
+    XLENGTH(ctx) != XLENGTH(len) || TYPEOF(context) != INTSXP ||
+    XLENGTH(context) != 1 || INTEGER(context)[0] < 0 ||
+    XLENGTH(ctx) > INT_MAX / 2
+  )
+    error("Logic Error: bad hunk data; contact maintainer."); // nocov
+
+  int n = (int) XLENGTH(ctx), i, j, k = 0;
+  const int *c = LOGICAL(ctx), *l = INTEGER(len);
+  double ctx2 = 2 * (double) INTEGER(context)[0];
+
+  // Context hunks show up at most twice
+
+  int *grp = (int *) R_alloc(2 * (size_t) n + 1, sizeof(int));
+  int *id = (int *) R_alloc(2 * (size_t) n + 1, sizeof(int));
+  int *op = (int *) R_alloc(2 * (size_t) n + 1, sizeof(int));
+
+#define HUNK_ADD(h, o) do {grp[k] = j; id[k] = (h) + 1; op[k++] = (o);} while(0)
+
+  // Same as the original R loop, but with 0-based `i`
+
+  i = n && c[0] ? 1 : 0;
+  j = 1;
+  while(i < n) {
+    if(i) HUNK_ADD(i - 1, 2);
+    HUNK_ADD(i, 0);
+    if(i < n - 1) {
+      // Hunks bleed into the next one due to context
+
+      while(i < n - 1 && l[i + 1] <= ctx2 && i + 2 < n) {
+        HUNK_ADD(i + 1, 0);
+        HUNK_ADD(i + 2, 0);
+        i += 2;
+      }
+      if(i < n - 1) HUNK_ADD(i + 1, 1);
+    }
+    ++j;
+    i += 2;
+  }
+#undef HUNK_ADD
+
+  SEXP res = PROTECT(allocVector(VECSXP, 3));
+  SEXP res_grp = PROTECT(allocVector(INTSXP, k));
+  SEXP res_id = PROTECT(allocVector(INTSXP, k));
+  SEXP res_op = PROTECT(allocVector(INTSXP, k));
+  for(i = 0; i < k; ++i) {
+    INTEGER(res_grp)[i] = grp[i];
+    INTEGER(res_id)[i] = id[i];
+    INTEGER(res_op)[i] = op[i];
+  }
+  SET_VECTOR_ELT(res, 0, res_grp);
+  SET_VECTOR_ELT(res, 1, res_id);
+  SET_VECTOR_ELT(res, 2, res_op);
+  UNPROTECT(4);
+  return res;
+}
@@ -21,7 +21,28 @@
 
 static const
 R_CallMethodDef callMethods[] = {
-  {"diffobj", (DL_FUNC) &DIFFOBJ_diffobj, 3},
+  {"diffobj", (DL_FUNC) &DIFFOBJ_diffobj, 7},
+  {"diffobj_batch", (DL_FUNC) &DIFFOBJ_diffobj_batch, 5},
+  {"diffobj_bench", (DL_FUNC) &DIFFOBJ_diffobj_bench, 5},
+  {"workspace", (DL_FUNC) &DIFFOBJ_workspace, 0},
+  {"words", (DL_FUNC) &DIFFOBJ_words, 2},
+  {"file_read", (DL_FUNC) &DIFFOBJ_file_read, 1},
+  {"file_ids", (DL_FUNC) &DIFFOBJ_file_ids, 3},
+  {"file_lines", (DL_FUNC) &DIFFOBJ_file_lines, 2},
+  {"file_close", (DL_FUNC) &DIFFOBJ_file_close, 1},
+  {"hunks", (DL_FUNC) &DIFFOBJ_hunks, 3},
+  {"hunks_group", (DL_FUNC) &DIFFOBJ_hunks_group, 3},
+  {"align", (DL_FUNC) &DIFFOBJ_align, 7},
+  {"strip_hz", (DL_FUNC) &DIFFOBJ_strip_hz, 2},
+  {"nchar", (DL_FUNC) &DIFFOBJ_nchar, 2},
+  {"wrap", (DL_FUNC) &DIFFOBJ_wrap, 2},
+  {"hash_tree", (DL_FUNC) &DIFFOBJ_hash_tree, 1},
+  {"dat_new", (DL_FUNC) &DIFFOBJ_dat_new, 1},
+  {"dat_get", (DL_FUNC) &DIFFOBJ_dat_get, 3},
+  {"dat_set", (DL_FUNC) &DIFFOBJ_dat_set, 4},
+  {"dat_rows", (DL_FUNC) &DIFFOBJ_dat_rows, 2},
+  {"dat_splice", (DL_FUNC) &DIFFOBJ_dat_splice, 4},
+  {"dat_list", (DL_FUNC) &DIFFOBJ_dat_list, 1},
   {NULL, NULL, 0}
 };
 
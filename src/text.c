@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) 2018  Brodie Gaslam
+ *
+ * This file is part of "diffobj - Diffs for R Objects"
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
+ */
+
+#include <limits.h>
+#include <string.h>
+#include "diffobj.h"
+
+/*
+ * Text utilities
+ *
+ * Widths are in characters as with `nchar(type="chars")`, and only ASCII and
+ * UTF-8 strings are handled so that we can count characters without knowing
+ * anything about the locale.
+ */
+
+// Whether a string is valid UTF-8, allowing the same sequences as `nchar`
+
+static int txt_valid_utf8(const unsigned char *s, int len) {
+  int i = 0;
+  while(i < len) {
+    unsigned char c = s[i];
+    int n;
+    if(c < 0x80) n = 0;
+    else if(c >= 0xC2 && c <= 0xDF) n = 1;
+    else if(c >= 0xE0 && c <= 0xEF) n = 2;
+    else if(c >= 0xF0 && c <= 0xF4) n = 3;
+    else return 0;
+    if(i + n >= len && n) return 0;
+    for(int j = 1; j <= n; ++j) if((s[i + j] & 0xC0) != 0x80) return 0;
+    i += n + 1;
+  }
+  return 1;
+}
+// Byte offset of the `n`th (0-based) character, or `len` if there are fewer
+
+static int txt_offset(const char *s, int len, int n) {
+  int i = 0;
+  for(; i < len; ++i)
+    if(((unsigned char) s[i] & 0xC0) != 0x80 && !n--) break;
+  return i;
+}
+/*
+ * Tab stops are at the cumulative sums of `stops`, with the last value of
+ * `stops` repeated as often as necessary.  Returns the first stop after `pos`.
+ */
+static double txt_next_stop(double pos, const int *stops, int n, double tot) {
+  if(pos >= tot)
+    return tot + ((double) (long long) ((pos - tot) / stops[n - 1]) + 1) *
+      stops[n - 1];
+  double stop = 0;
+  for(int i = 0; i < n; ++i) if((stop += stops[i]) > pos) break;
+  return stop;
+}
+/*
+ * Replace tabs by spaces up to the next tab stop, and simulate carriage returns
+ * by overwriting the text before them with the text after them, as
+ * `strip_hz_c_int` does for text without ANSI escape sequences.  Each string
+ * must not contain newlines.
+ *
+ * Returns NULL if any of the strings are NA or neither ASCII nor UTF-8 so
+ * that the caller can fall back to `strip_hz_c_int`.
+ */
+SEXP DIFFOBJ_strip_hz(SEXP txt, SEXP stops) {
+  if(
+    TYPEOF(txt) != STRSXP || TYPEOF(stops) != INTSXP || !XLENGTH(stops) ||
+    XLENGTH(stops) > INT_MAX
+  )
+    error("Logic Error: bad tab stop data; contact maintainer."); // nocov
+
+  R_xlen_t len = XLENGTH(txt), i;
+  int ns = (int) XLENGTH(stops), max_stop = 0;
+  const int *st = INTEGER(stops);
+  double tot = 0;
+  for(int j = 0; j < ns; ++j) {
+    if(st[j] == NA_INTEGER || st[j] < 1)
+      error("Logic Error: bad tab stops; contact maintainer."); // nocov
+    if(st[j] > max_stop) max_stop = st[j];
+    tot += st[j];
+  }
+  // Check encodings, and find the largest buffer we could need: each tab
+  // becomes at most `max_stop` spaces
+
+  double buf_max = 0;
+  for(i = 0; i < len; ++i) {
+    SEXP chrs = STRING_ELT(txt, i);
+    if(chrs == NA_STRING) return R_NilValue;
+    const char *s = CHAR(chrs);
+    int n = LENGTH(chrs), tabs = 0, ascii = 1;
+    for(int j = 0; j < n; ++j) {
+      tabs += s[j] == '\t';
+      ascii &= (unsigned char) s[j] < 0x80;
+    }
+    if(
+      !ascii && (
+        !IS_UTF8(chrs) || !txt_valid_utf8((const unsigned char *) s, n)
+      )
+    )
+      return R_NilValue;
+    if(n + (double) tabs * max_stop > buf_max)
+      buf_max = n + (double) tabs * max_stop;
+  }
+  if(buf_max >= INT_MAX)
+    error("Tab expanded strings too long.");
+
+  char *buf = R_alloc((size_t) buf_max + 1, 1);
+  char *out = R_alloc((size_t) buf_max + 1, 1);
+  int *p_start = (int *) R_alloc((size_t) buf_max + 1, sizeof(int));
+  int *p_len = (int *) R_alloc((size_t) buf_max + 1, sizeof(int));
+  int *p_chr = (int *) R_alloc((size_t) buf_max + 1, sizeof(int));
+
+  SEXP res = PROTECT(allocVector(STRSXP, len));
+  for(i = 0; i < len; ++i) {
+    SEXP chrs = STRING_ELT(txt, i);
+    const char *s = CHAR(chrs);
+    int b = 0, e = LENGTH(chrs), np = 0, k = 0;
+
+    if(!memchr(s, '\t', e) && !memchr(s, '\r', e)) {
+      SET_STRING_ELT(res, i, chrs);
+      continue;
+    }
+    // Leading and trailing CRs are dropped, and the runs of CRs in between
+    // separate the pieces that are written on top of each other
+
+    while(b < e && s[b] == '\r') ++b;
+    while(e > b && s[e - 1] == '\r') --e;
+
+    while(b < e || !np) {
+      int pe = b;
+      while(pe < e && s[pe] != '\r') ++pe;
+
+      // Expand tabs; CRs reset the tab stops
+
+      int chr = 0;
+      p_start[np] = k;
+      for(int j = b; j < pe; ++j) {
+        if(s[j] == '\t') {
+          int stop = (int) txt_next_stop(chr, st, ns, tot);
+          while(chr < stop) {
+            buf[k++] = ' ';
+            ++chr;
+          }
+        } else {
+          chr += ((unsigned char) s[j] & 0xC0) != 0x80;
+          buf[k++] = s[j];
+        }
+      }
+      p_len[np] = k - p_start[np];
+      p_chr[np++] = chr;
+      for(b = pe; b < e && s[b] == '\r'; ++b);
+    }
+    // The last piece is shown in full, and each earlier one only from past
+    // the widest piece after it
+
+    int o = p_len[np - 1], max_chr = p_chr[np - 1];
+    memcpy(out, buf + p_start[np - 1], o);
+    for(int p = np - 2; p >= 0; --p) {
+      const char *ps = buf + p_start[p];
+      int off = txt_offset(ps, p_len[p], max_chr);
+      memcpy(out + o, ps + off, p_len[p] - off);
+      o += p_len[p] - off;
+      if(p_chr[p] > max_chr) max_chr = p_chr[p];
+    }
+    SET_STRING_ELT(res, i, mkCharLenCE(out, o, getCharCE(chrs)));
+  }
+  UNPROTECT(1);
+  return res;
+}
+/*
+ * Length of the ANSI escape sequence at the start of `s`, or zero if there is
+ * none, as matched by `ansi_regex`.  The only backtracking the regular
+ * expression could do cannot lead to a match, so this is a greedy scan.
+ */
+static int txt_ansi_len(const char *s, int len) {
+  int i, j;
+  if(len < 2 || s[0] != '\033') return 0;
+  if(s[1] >= 'A' && s[1] <= 'M') return 2;
+  if(s[1] != '[') return 0;
+  for(i = 2, j = 0; i < len && j < 3 && s[i] >= '0' && s[i] <= '9'; ++i, ++j);
+  while(i < len && s[i] == ';')
+    for(++i, j = 0; i < len && j < 3 && s[i] >= '0' && s[i] <= '9'; ++i, ++j);
+  if(
+    i < len && (
+      (s[i] >= 'A' && s[i] <= 'M') || (s[i] >= 'f' && s[i] <= 'm') ||
+      s[i] == '|'
+  ) )
+    return i + 1;
+  return 0;
+}
+// Length of the HTML entity at the start of `s`, or zero if there is none
+
+static int txt_entity_len(const char *s, int len) {
+  int i = 1;
+  if(len < 3 || s[0] != '&') return 0;
+  if(s[1] == '#' && s[2] == 'x') {
+    for(i = 3; i < len && ((s[i] >= 'a' && s[i] <= 'f') ||
+      (s[i] >= '0' && s[i] <= '9')); ++i);
+    if(i > 3 && i < len && s[i] == ';') return i + 1;
+  }
+  if(s[1] == '#') {
+    for(i = 2; i < len && s[i] >= '0' && s[i] <= '9'; ++i);
+    return i > 2 && i < len && s[i] == ';' ? i + 1 : 0;
+  }
+  for(; i < len && ((s[i] >= 'a' && s[i] <= 'z') ||
+    (s[i] >= '0' && s[i] <= '9')); ++i);
+  return i > 1 && i < len && s[i] == ';' ? i + 1 : 0;
+}
+/*
+ * Whether a string can be measured here: not NA, and ASCII or valid UTF-8.
+ * For ANSI text we also require there be no 0x9B bytes as those may or may not
+ * be treated as CSI characters depending on how `crayon` matches escapes.
+ */
+static int txt_ok(SEXP chrs, int ansi) {
+  if(chrs == NA_STRING) return 0;
+  const unsigned char *s = (const unsigned char *) CHAR(chrs);
+  int n = LENGTH(chrs), ascii = 1;
+  for(int j = 0; j < n; ++j) {
+    ascii &= s[j] < 0x80;
+    if(ansi && s[j] == 0x9B) return 0;
+  }
+  return ascii || (IS_UTF8(chrs) && txt_valid_utf8(s, n));
+}
+/*
+ * Display width of each string in characters, not counting ANSI escape
+ * sequences (`type` 1, as `crayon::col_nchar`), or HTML tags, with entities
+ * counted as one character (`type` 2, as `nchar_html`).
+ *
+ * Returns NULL if any of the strings cannot be measured here.
+ */
+SEXP DIFFOBJ_nchar(SEXP x, SEXP type) {
+  int t = asInteger(type);
+  if(t != 1 && t != 2)
+    error("Logic Error: bad width type; contact maintainer."); // nocov
+  if(TYPEOF(x) != STRSXP) return R_NilValue;
+  R_xlen_t len = XLENGTH(x), i;
+  for(i = 0; i < len; ++i) if(!txt_ok(STRING_ELT(x, i), t == 1))
+    return R_NilValue;
+
+  // HTML tags are removed before matching entities, as they could be formed
+  // by removing tags
+
+  int n_max = 0;
+  for(i = 0; i < len; ++i)
+    if(LENGTH(STRING_ELT(x, i)) > n_max) n_max = LENGTH(STRING_ELT(x, i));
+  char *buf = t == 2 ? R_alloc((size_t) n_max + 1, 1) : NULL;
+
+  SEXP res = PROTECT(allocVector(INTSXP, len));
+  for(i = 0; i < len; ++i) {
+    SEXP chrs = STRING_ELT(x, i);
+    const char *s = CHAR(chrs);
+    int n = LENGTH(chrs), w = 0, j = 0, k;
+
+    if(t == 2) {
+      // Each `<` up to the next `>` is a tag; if there is no `>` there are no
+      // more tags
+
+      int m = 0, tags = 1;
+      while(j < n) {
+        if(tags && s[j] == '<') {
+          const char *gt = memchr(s + j, '>', n - j);
+          if(gt) {
+            j = (int) (gt - s) + 1;
+            continue;
+          }
+          tags = 0;
+        }
+        buf[m++] = s[j++];
+      }
+      s = buf;
+      n = m;
+      j = 0;
+    }
+    while(j < n) {
+      if(t == 1 && (k = txt_ansi_len(s + j, n - j))) {
+        j += k;
+      } else if(t == 2 && (k = txt_entity_len(s + j, n - j))) {
+        ++w;
+        j += k;
+      } else w += ((unsigned char) s[j++] & 0xC0) != 0x80;
+    }
+    INTEGER(res)[i] = w;
+  }
+  setAttrib(res, R_NamesSymbol, getAttrib(x, R_NamesSymbol));
+  UNPROTECT(1);
+  return res;
+}
+/*
+ * Split strings wider than `width` characters into pieces `width` characters
+ * wide, as `wrap_int` does for text without ANSI escape sequences.
+ *
+ * Returns a list with a character vector for each string, or NULL if any of
+ * the strings cannot be measured here or `width` is not a positive integer.
+ */
+SEXP DIFFOBJ_wrap(SEXP x, SEXP width) {
+  double wd = asReal(width);
+  if(TYPEOF(x) != STRSXP || !(wd >= 1) || wd != (int) wd) return R_NilValue;
+  int w = (int) wd;
+  R_xlen_t len = XLENGTH(x), i;
+  for(i = 0; i < len; ++i) if(!txt_ok(STRING_ELT(x, i), 0))
+    return R_NilValue;
+
+  SEXP res = PROTECT(allocVector(VECSXP, len));
+  for(i = 0; i < len; ++i) {
+    SEXP chrs = STRING_ELT(x, i);
+    const char *s = CHAR(chrs);
+    int n = LENGTH(chrs), nc = 0;
+    for(int j = 0; j < n; ++j) nc += ((unsigned char) s[j] & 0xC0) != 0x80;
+
+    int pieces = nc > w ? (nc - 1) / w + 1 : 1;
+    SEXP str = PROTECT(allocVector(STRSXP, pieces));
+    if(pieces == 1) {
+      SET_STRING_ELT(str, 0, chrs);
+    } else {
+      int b = 0;
+      for(int p = 0; p < pieces; ++p) {
+        int e = b + txt_offset(s + b, n - b, w);
+        SET_STRING_ELT(str, p, mkCharLenCE(s + b, e - b, getCharCE(chrs)));
+        b = e;
+      }
+    }
+    SET_VECTOR_ELT(res, i, str);
+    UNPROTECT(1);
+  }
+  UNPROTECT(1);
+  return res;
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2018  Brodie Gaslam
+ *
+ * This file is part of "diffobj - Diffs for R Objects"
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "diffobj.h"
+
+/*
+ * Merkle hashes of R objects
+ *
+ * Each object is hashed from its type, its data, and the hashes of its
+ * elements and attributes, so that objects that are `identical` have the same
+ * hash, save for attribute order, encodings, and signed zeroes and NaN
+ * payloads, which only cause `identical` objects to hash differently.
+ * Environments, external pointers, and other reference objects are hashed by
+ * address as `identical` compares them.
+ */
+
+static uint64_t th_bytes(uint64_t h, const void *p, size_t n) {
+  const unsigned char *s = (const unsigned char *) p;
+  for(size_t i = 0; i < n; ++i) h = (h ^ s[i]) * 1099511628211ULL;  // FNV-1a
+  return h;
+}
+static uint64_t th_mix(uint64_t h, uint64_t v) {
+  return th_bytes(h, &v, sizeof(v));
+}
+static SEXP th_hex(uint64_t h) {
+  char buf[17];
+  snprintf(
+    buf, sizeof(buf), "%08x%08x", (unsigned int) (h >> 32),
+    (unsigned int) (h & 0xffffffffU)
+  );
+  return mkChar(buf);
+}
+// Plain lists and S4 objects have their subtrees recorded
+
+static int th_is_list(SEXP x) {
+  return TYPEOF(x) == VECSXP &&
+    getAttrib(x, R_ClassSymbol) == R_NilValue &&
+    getAttrib(x, R_DimSymbol) == R_NilValue;
+}
+static int th_is_s4(SEXP x) {
+  return TYPEOF(x) == S4SXP && IS_S4_OBJECT(x);
+}
+/*
+ * Hash `x`, and if `tree` is not NULL and `x` is a plain list or S4 object,
+ * set `tree` to a list with the hash, a character vector with the hashes of
+ * the elements (slots for S4 objects, named accordingly), and a list with the
+ * trees of the elements that are themselves lists or S4 objects, or NULL.
+ * The tree is not protected on return.
+ */
+static uint64_t th_node(SEXP x, SEXP *tree) {
+  R_CheckStack();
+  uint64_t h = 14695981039346656037ULL;
+  h = th_mix(h, (uint64_t) TYPEOF(x));
+  h = th_mix(h, (uint64_t) (OBJECT(x) | (IS_S4_OBJECT(x) ? 2 : 0)));
+
+  int s4 = tree && th_is_s4(x);
+  int list = tree && th_is_list(x);
+  SEXP chld = R_NilValue, sub = R_NilValue;
+  int prt = 0;
+
+  if(s4 || list) {
+    R_xlen_t n = 0;
+    if(list) n = XLENGTH(x);
+    else
+      for(SEXP a = ATTRIB(x); a != R_NilValue; a = CDR(a))
+        n += TAG(a) != R_ClassSymbol;
+
+    *tree = PROTECT(allocVector(VECSXP, 3)); ++prt;
+    chld = allocVector(STRSXP, n);
+    SET_VECTOR_ELT(*tree, 1, chld);
+    sub = allocVector(VECSXP, n);
+    SET_VECTOR_ELT(*tree, 2, sub);
+  }
+  switch(TYPEOF(x)) {
+    case NILSXP:
+      break;
+    case LGLSXP:
+    case INTSXP:
+      h = th_bytes(h, INTEGER(x), XLENGTH(x) * sizeof(int));
+      break;
+    case REALSXP:
+      h = th_bytes(h, REAL(x), XLENGTH(x) * sizeof(double));
+      break;
+    case CPLXSXP:
+      h = th_bytes(h, COMPLEX(x), XLENGTH(x) * sizeof(Rcomplex));
+      break;
+    case RAWSXP:
+      h = th_bytes(h, RAW(x), XLENGTH(x));
+      break;
+    case STRSXP:
+      for(R_xlen_t i = 0; i < XLENGTH(x); ++i) {
+        SEXP chr = STRING_ELT(x, i);
+        if(chr == NA_STRING) {
+          h = th_mix(h, UINT64_MAX);
+        } else {
+          h = th_mix(h, (uint64_t) LENGTH(chr));
+          h = th_bytes(h, CHAR(chr), LENGTH(chr));
+        }
+      }
+      break;
+    case CHARSXP:
+      h = th_bytes(h, CHAR(x), LENGTH(x));
+      break;
+    case SYMSXP:
+      h = th_bytes(h, CHAR(PRINTNAME(x)), LENGTH(PRINTNAME(x)));
+      break;
+    case VECSXP:
+    case EXPRSXP:
+      for(R_xlen_t i = 0; i < XLENGTH(x); ++i) {
+        SEXP sub_tree = R_NilValue;
+        uint64_t hc = th_node(VECTOR_ELT(x, i), list ? &sub_tree : NULL);
+        if(list) {
+          SET_VECTOR_ELT(sub, i, sub_tree);
+          SET_STRING_ELT(chld, i, th_hex(hc));
+        }
+        h = th_mix(h, hc);
+      }
+      break;
+    case LISTSXP:
+    case LANGSXP:
+    case DOTSXP: {
+      SEXP y = x;
+      for(
+        ; y != R_NilValue && (
+          TYPEOF(y) == LISTSXP || TYPEOF(y) == LANGSXP || TYPEOF(y) == DOTSXP
+        );
+        y = CDR(y)
+      ) {
+        h = th_mix(h, th_node(TAG(y), NULL));
+        h = th_mix(h, th_node(CAR(y), NULL));
+      }
+      if(y != R_NilValue) h = th_mix(h, th_node(y, NULL));
+      break;
+    }
+    case CLOSXP:
+      h = th_mix(h, th_node(FORMALS(x), NULL));
+      h = th_mix(h, th_node(BODY(x), NULL));
+      h = th_mix(h, (uint64_t) (uintptr_t) CLOENV(x));
+      break;
+    case S4SXP:
+      break;
+    default:
+      h = th_mix(h, (uint64_t) (uintptr_t) x);
+  }
+  // Attributes; the slots of S4 objects we record are elements of the tree
+
+  if(TYPEOF(x) != CHARSXP) {
+    SEXP names = R_NilValue;
+    if(s4) {
+      names = PROTECT(allocVector(STRSXP, XLENGTH(chld))); ++prt;
+    }
+    R_xlen_t i = 0;
+    for(SEXP a = ATTRIB(x); a != R_NilValue; a = CDR(a)) {
+      h = th_mix(h, th_node(TAG(a), NULL));
+      if(s4 && TAG(a) != R_ClassSymbol) {
+        SEXP sub_tree = R_NilValue;
+        uint64_t hc = th_node(CAR(a), &sub_tree);
+        SET_VECTOR_ELT(sub, i, sub_tree);
+        SET_STRING_ELT(chld, i, th_hex(hc));
+        SET_STRING_ELT(names, i, PRINTNAME(TAG(a)));
+        ++i;
+        h = th_mix(h, hc);
+      } else {
+        h = th_mix(h, th_node(CAR(a), NULL));
+      }
+    }
+    if(s4) setAttrib(chld, R_NamesSymbol, names);
+  }
+  if(s4 || list) SET_VECTOR_ELT(*tree, 0, ScalarString(th_hex(h)));
+  UNPROTECT(prt);
+  return h;
+}
+/*
+ * Returns the hash of `x` as a hexadecimal string, or for plain lists and S4
+ * objects the tree described in `th_node`.
+ */
+SEXP DIFFOBJ_hash_tree(SEXP x) {
+  SEXP tree = R_NilValue;
+  uint64_t h = th_node(x, &tree);
+  if(tree != R_NilValue) return tree;
+  return ScalarString(th_hex(h));
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2018  Brodie Gaslam
+ *
+ * This file is part of "diffobj - Diffs for R Objects"
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
+ */
+
+#include "diffobj.h"
+
+/*
+ * Word tokenizer
+ *
+ * Splits lines into the same words as the `word_reg` PCRE pattern does with
+ * `gregexpr(..., perl=TRUE)`.  The pattern is:
+ *
+ *   \s*(?:IDENT|[^ "]+|QUOTE1|QUOTE2|")
+ *
+ * where QUOTE1 is only present with `match.quotes`.  PCRE tries alternatives
+ * left to right, and nothing follows the group, so the first one that matches
+ * after the greedy `\s*` decides the word.  The only backtracking that can
+ * matter is `\s*` giving back characters at the end of the string, and the
+ * lazy quoted phrase loops, both of which are reproduced below.
+ *
+ * Only ASCII strings are handled here as that is when `gregexpr` reports byte
+ * offsets and the POSIX classes have their plain C meaning.
+ */
+
+static int w_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' ||
+    c == '\r';
+}
+static int w_alpha(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+static int w_ident(char c) {
+  return w_alpha(c) || (c >= '0' && c <= '9') || c == '_' || c == '.';
+}
+// PCRE `$`: end of string, or before a newline that ends the string
+
+static int w_eos(const char *s, int i, int n) {
+  return i == n || (i == n - 1 && s[i] == '\n');
+}
+// Characters allowed before/after quoted phrases for QUOTE2
+
+static int w_quote_pre(char c) {
+  return c == ' ' || c == '(' || c == '[' || c == ',' || c == '{';
+}
+static int w_quote_post(char c) {
+  return c == ' ' || c == ',' || c == ')' || c == ']' || c == '}';
+}
+/*
+ * Match the alternation group at `q`, return the end of the match or -1
+ */
+static int w_group(const char *s, int q, int n, int quotes) {
+  if(q >= n) return -1;
+  char c = s[q];
+  int e;
+
+  // R identifier: (?:\.[[:alpha:]]|[[:alpha:]])[[:alnum:]_.]*
+
+  if(w_alpha(c) || (c == '.' && q + 1 < n && w_alpha(s[q + 1]))) {
+    for(e = q + (c == '.' ? 2 : 1); e < n && w_ident(s[e]); ++e);
+    return e;
+  }
+  // [^ "]+
+
+  if(c != ' ' && c != '"') {
+    for(e = q + 1; e < n && s[e] != ' ' && s[e] != '"'; ++e);
+    return e;
+  }
+  if(c != '"') return -1;
+
+  // (?<= |^)"(?:[^"]|\")*?"(?= |$); `\"` is a plain quote to PCRE so the lazy
+  // loop can step past any character, and stops at the first quote that can
+  // close the phrase
+
+  if(quotes && (q == 0 || s[q - 1] == ' ')) {
+    for(e = q + 1; e < n; ++e) {
+      if(s[e] == '"' && (w_eos(s, e + 1, n) || s[e + 1] == ' '))
+        return e + 1;
+    }
+  }
+  // (?<=[ ([,{]|^)"(?:[^"]|\"|"(?=[^ ]))*?"(?=[ ,)\]}]|$); any quote that
+  // cannot close the phrase is followed by a non-space and can be stepped past
+
+  if(q == 0 || w_quote_pre(s[q - 1])) {
+    for(e = q + 1; e < n; ++e) {
+      if(s[e] == '"' && (w_eos(s, e + 1, n) || w_quote_post(s[e + 1])))
+        return e + 1;
+    }
+  }
+  // Lone quote
+
+  return q + 1;
+}
+/*
+ * Find the match starting at `p`, return its end or -1 if there is none (in
+ * which case there are none later in the string either)
+ */
+static int w_match(const char *s, int p, int n, int quotes) {
+  int w, e;
+  for(w = p; w < n && w_space(s[w]); ++w);
+  for(; w >= p; --w) if((e = w_group(s, w, n, quotes)) >= 0) return e;
+  return -1;
+}
+/*
+ * Returns a list with the 1-based starts and lengths of each word (including
+ * their leading whitespace), the number of words in each line, and the words
+ * themselves with leading whitespace removed as `trimws(x, "left")` would.
+ *
+ * Returns NULL if any element is NA or not ASCII so the caller can fall back
+ * to `gregexpr`.
+ */
+SEXP DIFFOBJ_words(SEXP chr, SEXP match_quotes) {
+  if(TYPEOF(chr) != STRSXP)
+    error("Logic Error: `chr` must be character"); // nocov
+  if(
+    TYPEOF(match_quotes) != LGLSXP || XLENGTH(match_quotes) != 1 ||
+    LOGICAL(match_quotes)[0] == NA_LOGICAL
+  )
+    error("Logic Error: `match.quotes` must be TRUE or FALSE"); // nocov
+
+  int quotes = LOGICAL(match_quotes)[0];
+  R_xlen_t len = XLENGTH(chr), i, k, max = 0;
+
+  for(i = 0; i < len; ++i) {
+    SEXP chrs = STRING_ELT(chr, i);
+    if(chrs == NA_STRING) return R_NilValue;
+    const unsigned char *s = (const unsigned char *) CHAR(chrs);
+    int n = LENGTH(chrs);
+    for(int j = 0; j < n; ++j) if(s[j] > 127) return R_NilValue;
+    max += n;
+  }
+  // There can be at most one word per character
+
+  int *starts = (int *) R_alloc(max ? max : 1, sizeof(int));
+  int *ends = (int *) R_alloc(max ? max : 1, sizeof(int));
+
+  SEXP lens = PROTECT(allocVector(INTSXP, len));
+  for(i = 0, k = 0; i < len; ++i) {
+    const char *s = CHAR(STRING_ELT(chr, i));
+    int n = LENGTH(STRING_ELT(chr, i)), p = 0, e;
+    R_xlen_t k0 = k;
+    while(p < n && (e = w_match(s, p, n, quotes)) >= 0) {
+      starts[k] = p;
+      ends[k++] = e;
+      p = e;
+    }
+    INTEGER(lens)[i] = (int) (k - k0);
+  }
+  SEXP res = PROTECT(allocVector(VECSXP, 4));
+  SEXP start = PROTECT(allocVector(INTSXP, k));
+  SEXP mlen = PROTECT(allocVector(INTSXP, k));
+  SEXP words = PROTECT(allocVector(STRSXP, k));
+
+  for(i = 0, k = 0; i < len; ++i) {
+    const char *s = CHAR(STRING_ELT(chr, i));
+    for(int j = 0; j < INTEGER(lens)[i]; ++j, ++k) {
+      int p = starts[k], e = ends[k];
+      INTEGER(start)[k] = p + 1;
+      INTEGER(mlen)[k] = e - p;
+      while(
+        p < e && (s[p] == ' ' || s[p] == '\t' || s[p] == '\r' || s[p] == '\n')
+      ) ++p;
+      SET_STRING_ELT(words, k, mkCharLenCE(s + p, e - p, CE_NATIVE));
+    }
+  }
+  SET_VECTOR_ELT(res, 0, start);
+  SET_VECTOR_ELT(res, 1, mlen);
+  SET_VECTOR_ELT(res, 2, lens);
+  SET_VECTOR_ELT(res, 3, words);
+  UNPROTECT(5);
+
+  return res;
+}